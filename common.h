@@ -33,17 +33,22 @@
 #ifndef NO_THREADS
 #include <pthread.h>
 
-#ifdef PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
-#define MUTEX_INIT PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
-#else
-#define MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
-#endif
+#ifdef LOCK_STATS
+// instrumented (see PROM_MUTEX in prom.h): contention shows
+// up as prom_mutex_wait_seconds{mutex="prom_NAME"}
+#define DECLARE_LOCK(NAME) \
+    _PROM_MUTEX(static,prom_##NAME,0);
 
+#define LOCK(NAME) PROM_MUTEX_LOCK(prom_##NAME)
+#define UNLOCK(NAME) PROM_MUTEX_UNLOCK(prom_##NAME)
+
+#else
 #define DECLARE_LOCK(NAME) \
-    static pthread_mutex_t NAME = MUTEX_INIT;
+    static pthread_mutex_t NAME = PROM_MUTEX_INIT;
 
 #define LOCK(NAME) pthread_mutex_lock(&NAME)
 #define UNLOCK(NAME) pthread_mutex_unlock(&NAME)
+#endif
 
 #else
 #define DECLARE_LOCK(NAME)
@@ -52,3 +57,122 @@
 #endif
 
 int prom_process_common_init(void);
+
+////////////////
+// library internals
+
+// all prom_vars are contiguous in the loader section
+// could do alignment fudgery here?
+#define FOREACH_PROM_VAR(PVP, START, STOP) \
+    for (PVP = START; \
+	 PVP < STOP; \
+	 PVP = ((void *)PVP) + PVP->size)
+
+int prom_section(struct prom_var **startp, struct prom_var **stopp);
+
+// a family: a top level var, with its LABEL vars
+struct prom_family {
+    struct prom_var *pvp;
+    struct prom_var **children;		// LABEL vars, in label order
+    int nchildren;
+    int slow;				// set by prom_mark_slow
+    char *cache;			// last output of slow family
+    size_t cachelen;
+};
+int prom_index(struct prom_family **familiesp);
+int prom_format_family(PROM_FILE *f, struct prom_family *pfp);
+
+// scrape deadlines
+extern prom_value prom_deadline_skips;
+int prom_deadline_passed(const struct timespec *deadline);
+void prom_deadline_skipped(void);
+int prom_format_family_by(PROM_FILE *f, struct prom_family *pfp,
+			  const struct timespec *deadline);
+
+// parallel formatter: returns negative to format serially
+extern int (*prom_eval_hook)(PROM_FILE *f, struct prom_family *families,
+			     int n, const char *marks,
+			     const struct timespec *deadline);
+int prom_format_one(PROM_FILE *f, struct prom_var *pvp);
+void prom_format_defer(struct prom_var *pvp);
+
+void prom_histogram_check(struct prom_hist_var *phvp);
+void prom_histogram_label_check(struct prom_hist_label_var *phlvp);
+const char *prom_nlabel_render(struct prom_nlabel_var *pnlvp);
+
+// values are read thru hooks if mapped
+// (ie; summed over processes by prom_shm.c)
+extern long long (*prom_read_hook)(prom_value *valp);
+extern double (*prom_read_dbl_hook)(double *dblp);
+extern void (*prom_scrape_hook)(void);	// called before formatting
+
+#define PROM_READ(VALP) \
+    (prom_read_hook ? (prom_read_hook)(VALP) : (long long)*(VALP))
+#define PROM_READ_DBL(DBLP) \
+    (prom_read_dbl_hook ? (prom_read_dbl_hook)(DBLP) : *(DBLP))
+
+// mapped values (prom_map.c)
+struct prom_map_var {
+    struct prom_var *pvp;
+    struct prom_var *family;		// parent, for LABEL vars
+    prom_value **valpp;			// integer storage pointer
+    int nint;
+    double **dblpp;			// double storage pointer (or NULL)
+    int ndbl;
+    int islot, dslot;			// first slot of each kind
+};
+int prom_map_walk(int (*fn)(struct prom_map_var *, void *), void *arg,
+		  int *nintp, int *ndblp);
+int prom_map_values(prom_value *ints, double *dbls, int copy);
+int prom_map_claim(void);
+void prom_map_release(void);
+
+// prom_mmap.c
+struct prom_mmap_hdr;
+struct prom_mmap_hdr *prom_mmap_create(const char *path, size_t *sizep);
+
+// /proc scanners (prom_process_linux.c)
+const char *prom_proc_scan_num(const char *cp, const char *end,
+			       unsigned long long *vp);
+const char *prom_proc_scan_comm(const char *cp, const char *end,
+				char *buf, size_t size);
+
+// samples of rendered output (prom_sample.c), for push outputs
+struct prom_sample {
+    const char *family;			// from "# TYPE" line
+    int familylen;
+    int type;				// GAUGE, COUNTER, HISTOGRAM or -1
+    const char *name;			// sample name (family + suffix)
+    int namelen;
+    const char *labels;			// between braces (or NULL)
+    int labelslen;
+    double value;
+};
+struct prom_sample_label {
+    const char *name;
+    int namelen;
+    const char *value;
+    int valuelen;
+};
+int prom_sample_walk(int (*fn)(const struct prom_sample *, void *), void *arg);
+int prom_sample_label(const struct prom_sample *psp, const char **posp,
+		      struct prom_sample_label *lp);
+
+// async getters:
+extern int prom_collector_interval;	// zero if no collector running
+double prom_async_collect(struct prom_async_var *pavp, time_t now);
+
+// publish doubles thru (atomic) prom_value
+static inline long long
+prom_dbl_to_bits(double d) {
+    union { double d; long long ll; } u;
+    u.d = d;
+    return u.ll;
+}
+
+static inline double
+prom_bits_to_dbl(long long ll) {
+    union { double d; long long ll; } u;
+    u.ll = ll;
+    return u.d;
+}
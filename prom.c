@@ -26,39 +26,42 @@
  */
 
 #include <stdarg.h>
+#include <stdlib.h>			/* malloc */
+#include <string.h>			/* strlen */
 
 #include "prom.h"
+#include "common.h"
 
-#ifdef __APPLE__
-#include <mach-o/getsect.h>
-#ifdef __LP64__
-#define SECTION section_64
-#else
-#define SECTION section
-#endif // APPLE, not LP64
-
-#else // not __APPLE__
+// globals
+time_t prom_now;
+const char *prom_namespace = "";	// must include trailing '_'
+int prom_collector_interval;		// zero if no collector running
 
-#define CONC(X,Y) CONC2(X,Y)
-#define CONC2(X,Y) X##Y
-#define START_PROM_SECTION CONC(__start_,PROM_SECTION_NAME)
-#define STOP_PROM_SECTION CONC(__stop_,PROM_SECTION_NAME)
+// set by prom_shm_init
+long long (*prom_read_hook)(prom_value *valp);
+double (*prom_read_dbl_hook)(double *dblp);
+void (*prom_scrape_hook)(void);
 
-extern struct prom_var START_PROM_SECTION[1], STOP_PROM_SECTION[1];
-#endif // not __APPLE__
+// PROM_VAR_SPARSE var whose TYPE/HELP lines wait for its first
+// sample (per thread: prom_eval formats families in parallel)
+static __thread struct prom_var *prom_deferred;
 
-// could do alignment fudgery here?
-#define FOREACH_PROM_VAR(PVP) \
-    for (PVP = START_PROM_SECTION; \
-	 PVP < STOP_PROM_SECTION; \
-	 PVP = ((void *)PVP) + PVP->size)
+static void prom_format_header(PROM_FILE *f, struct prom_var *pvp);
 
-// globals
-time_t prom_now;
-const char *prom_namespace = "";	// must include trailing '_'
+// defer TYPE/HELP of PVP until prom_format_start (NULL: drop)
+void
+prom_format_defer(struct prom_var *pvp) {
+    prom_deferred = pvp;
+}
 
 int
 prom_format_start(PROM_FILE *f, int *state, struct prom_var *pvp) {
+    if (prom_deferred) {
+	struct prom_var *deferred = prom_deferred;
+
+	prom_deferred = NULL;
+	prom_format_header(f, deferred);
+    }
     *state = 0;
     PROM_PUTS(prom_namespace, f);
     return PROM_PUTS(pvp->name, f);
@@ -90,6 +93,19 @@ prom_format_label(PROM_FILE *f, int *state, const char *name,
     return 0;				/* XXX */
 }
 
+// output labels already rendered as name1="value1",...
+int
+prom_format_labels(PROM_FILE *f, int *state, const char *rendered) {
+    if (!*state) {
+	PROM_PUTC('{', f);
+	*state = 1;
+    }
+    else
+	PROM_PUTC(',', f);
+    PROM_PUTS(rendered, f);
+    return 0;				/* XXX */
+}
+
 int
 prom_format_value(PROM_FILE *f, int *state, const char *format, ...) {
     va_list ap;
@@ -128,7 +144,54 @@ prom_format_simple(PROM_FILE *f, struct prom_var *pvp) {
     struct prom_simple_var *psvp = (struct prom_simple_var *)pvp;
 
     prom_format_start(f, &state, pvp);
-    return prom_format_value_pv(f, &state, psvp->value);
+    return prom_format_value_pv(f, &state, PROM_READ(psvp->valp));
+}
+
+// render "{label="value"}" for each slot (once)
+static const char **
+prom_counter_array_render(struct prom_counter_array_var *pcavp) {
+    DECLARE_LOCK(counter_array_lock);
+    const char **rendered;
+    size_t len = 0;
+    char *cp;
+    int i;
+
+    LOCK(counter_array_lock);
+    if (!pcavp->rendered) {
+	for (i = 0; i < pcavp->n; i++)
+	    len += strlen(pcavp->label) + strlen(pcavp->values[i]) + 6;
+	// pointers, then strings
+	rendered = malloc(pcavp->n * sizeof(char *) + len);
+	if (rendered) {
+	    cp = (char *)(rendered + pcavp->n);
+	    for (i = 0; i < pcavp->n; i++) {
+		rendered[i] = cp;
+		cp += sprintf(cp, "{%s=\"%s\"}", pcavp->label,
+			      pcavp->values[i]) + 1;
+	    }
+	    pcavp->rendered = rendered;
+	}
+    }
+    UNLOCK(counter_array_lock);
+    return pcavp->rendered;
+}
+
+// prom_var.format for a counter array
+// returns negative on failure
+int
+prom_format_counter_array(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_counter_array_var *pcavp = (struct prom_counter_array_var *)pvp;
+    const char **rendered = pcavp->rendered;
+    int state, i;
+
+    if (!rendered && !(rendered = prom_counter_array_render(pcavp)))
+	return -1;
+    for (i = 0; i < pcavp->n; i++) {
+	prom_format_start(f, &state, pvp);
+	PROM_PUTS(rendered[i], f);	// includes closing brace
+	prom_format_value_pv(f, &state, pcavp->slots[i].value);
+    }
+    return 0;
 }
 
 // prom_var.format for a "getter" variable
@@ -142,6 +205,55 @@ prom_format_getter(PROM_FILE *f, struct prom_var *pvp) {
     return prom_format_value_dbl(f, &state, pgvp->getter());
 }
 
+// prom_var.format for a double gauge
+int
+prom_format_double_gauge(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_double_gauge_var *pdgvp = (struct prom_double_gauge_var *)pvp;
+    int state;
+
+    prom_format_start(f, &state, pvp);
+    return prom_format_value_dbl(f, &state, prom_double_load(&pdgvp->value));
+}
+
+// prom_var.format for a fixed point gauge
+int
+prom_format_fixed_gauge(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_fixed_gauge_var *pfgvp = (struct prom_fixed_gauge_var *)pvp;
+    long long value = pfgvp->value;
+    int state;
+
+    prom_format_start(f, &state, pvp);
+    return prom_format_value_dbl(f, &state, (double)value / pfgvp->scale);
+}
+
+// call async getter, and publish value (collected at NOW)
+double
+prom_async_collect(struct prom_async_var *pavp, time_t now) {
+    double value = pavp->getter();
+
+    pavp->bits = prom_dbl_to_bits(value);
+    pavp->stamp = now;
+    return value;
+}
+
+// prom_var.format for an async getter:
+// uses cached value if collector running
+// returns negative on failure
+int
+prom_format_async(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_async_var *pavp = (struct prom_async_var *)pvp;
+    int state;
+    double value;
+
+    if (prom_collector_interval && pavp->stamp)
+	value = prom_bits_to_dbl(pavp->bits);
+    else				// not (yet) collected
+	value = prom_async_collect(pavp, prom_now);
+
+    prom_format_start(f, &state, pvp);
+    return prom_format_value_dbl(f, &state, value);
+}
+
 // prom_var.format for a labeled var
 // no value of its own
 int
@@ -161,7 +273,7 @@ prom_format_simple_label(PROM_FILE *f, struct prom_var *pvp) {
 
     prom_format_start(f, &state, &parent->base);
     prom_format_label(f, &state, parent->label, "%s", pvp->name);
-    return prom_format_value_pv(f, &state, pslv->value);
+    return prom_format_value_pv(f, &state, PROM_READ(pslv->valp));
     return 0;
 }
 
@@ -179,8 +291,9 @@ prom_format_getter_label(PROM_FILE *f, struct prom_var *pvp) {
     return 0;
 }
 
-static int
-prom_format_one(PROM_FILE *f, struct prom_var *pvp) {
+// TYPE & HELP lines
+static void
+prom_format_header(PROM_FILE *f, struct prom_var *pvp) {
     switch (pvp->type) {
     case GAUGE:
 	PROM_PRINTF(f, "# TYPE %s%s gauge\n", prom_namespace, pvp->name);
@@ -196,31 +309,20 @@ prom_format_one(PROM_FILE *f, struct prom_var *pvp) {
     }
     if (pvp->help)		// LABEL (subvars) lack help
 	PROM_PRINTF(f, "# HELP %s%s %s.\n", prom_namespace, pvp->name, pvp->help);
-    return (pvp->format)(f, pvp);
 }
 
+// format one var, w/ TYPE & HELP lines
+// (only if it has samples, if PROM_VAR_SPARSE)
 int
-prom_format_vars(PROM_FILE *f) {
-#ifdef __APPLE__
-    static struct prom_var *start_prom_section, *stop_prom_section;
+prom_format_one(PROM_FILE *f, struct prom_var *pvp) {
+    int ret;
 
-    if (!start_prom_section) {
-	const struct SECTION *sect = getsectbyname(PROM_SEGMENT, PROM_SECTION_STR);
-	if (sect) {
-	    start_prom_section = (struct prom_var *) sect->addr;
-	    stop_prom_section  = (struct prom_var *) (sect->addr + sect->size);
-	}
-	else
-	    return -1;
-    }
-#define START_PROM_SECTION start_prom_section
-#define STOP_PROM_SECTION stop_prom_section
-#endif
-    struct prom_var *pvp;
-
-    time(&prom_now);
-    FOREACH_PROM_VAR(pvp) {
-	prom_format_one(f, pvp);	// XXX check return?
+    if (!(pvp->flags & PROM_VAR_SPARSE)) {
+	prom_format_header(f, pvp);
+	return (pvp->format)(f, pvp);
     }
-    return 0;
+    prom_format_defer(pvp);
+    ret = (pvp->format)(f, pvp);
+    prom_format_defer(NULL);
+    return ret;
 }
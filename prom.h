@@ -25,6 +25,7 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <assert.h>			/* PROM_COUNTER_ARRAY_INC */
 #include <time.h>
 
 #ifndef PROM_FILE
@@ -35,6 +36,10 @@
 #define PROM_GETS fgets
 #define PROM_PUTS fputs
 #define PROM_PUTC fputc
+// output to memory (used by prom_eval_init): PROM_CLOSE leaves
+// a NUL terminated string in *BUFP (to be freed), length in *LENP
+#define PROM_MEMSTREAM(BUFP,LENP) open_memstream(BUFP,LENP)
+#define PROM_CLOSE fclose
 #endif
 
 #ifdef NO_THREADS
@@ -94,11 +99,18 @@ struct prom_var {
     const char *name;
     const char *help;
     int (*format)(PROM_FILE *, struct prom_var *);
+    int flags;				// PROM_VAR_*
 } PROM_ALIGN;
 
+// prom_var.flags:
+#define PROM_VAR_CHEAP 1		// format calls no user code
+#define PROM_VAR_ASYNC 2		// cheap once collected
+#define PROM_VAR_SPARSE 4		// TYPE/HELP only if there are samples
+
 struct prom_simple_var {
     struct prom_var base;
     prom_value value;
+    prom_value *valp;			// &value, or slot in mapped memory
 } PROM_ALIGN;
 
 struct prom_getter_var {
@@ -110,9 +122,40 @@ struct prom_hist_var {
     struct prom_var base;
     int nbins;			// not including +inf
     double *limits;		// double[nbins]
-    prom_value *bins;
-    prom_value count;		// also +Inf bin
+    prom_value *bins;		// prom_value[nbins+1]: last is +Inf (count)
+    double *sump;		// &sum, or slot in mapped memory
     double sum;			// XXX need lock?
+    prom_value tick_sum;	// PROM_HISTOGRAM_TIME_STOP (if not mapped)
+    long long *tick_limits;	// limits in prom_ticks()
+} PROM_ALIGN;
+
+// integer histogram: power of two limits
+struct prom_int_hist_var {
+    struct prom_var base;
+    int min_pow, max_pow;	// limits 2^min_pow .. 2^max_pow
+    prom_value *bins;		// prom_value[max_pow-min_pow+2]: NOT cumulative
+    prom_value sum;
+} PROM_ALIGN;
+
+// double value: updated by CAS on the bit pattern
+struct prom_double_gauge_var {
+    struct prom_var base;
+    double value __attribute__((aligned(8)));
+} PROM_ALIGN;
+
+// fixed point value: in units of 1/scale
+struct prom_fixed_gauge_var {
+    struct prom_var base;
+    prom_value value;
+    long long scale;
+} PROM_ALIGN;
+
+// getter called by a background collector thread (if started)
+struct prom_async_var {
+    struct prom_var base;
+    double (*getter)(void);
+    prom_value bits;			// last value (double bit pattern)
+    prom_value stamp;			// prom_now when collected
 } PROM_ALIGN;
 
 // **************** single label
@@ -129,6 +172,7 @@ struct prom_simple_label_var {
     struct prom_labeled_var *parent_var; // variable being labeled
     // could have pointer to next label...
     prom_value value;
+    prom_value *valp;			// &value, or slot in mapped memory
 } PROM_ALIGN;
 
 struct prom_getter_label_var {
@@ -138,45 +182,111 @@ struct prom_getter_label_var {
     double (*getter)(void);
 } PROM_ALIGN;
 
-// **************** two labels
+// common prefix of all LABEL (sub)vars:
+// allows finding the parent of any LABEL var
+struct prom_label_var {
+    struct prom_var base;		// NOTE: name is label string!
+    struct prom_var *parent_var;	// base of variable being labeled
+} PROM_ALIGN;
+
+// **************** N labels
 
-struct prom_2labeled_var {
+struct prom_nlabeled_var {
     struct prom_var base;
-    const char *label1;
-    const char *label2;
+    int nlabels;
+    const char *const *labels;		// label names[nlabels]
 } PROM_ALIGN;
 
-// have prom_label_var sub/base class?
-// would be needed to make list of all label vars
-struct prom_simple_2label_var {
-    struct prom_var base;		// NOTE: name is label string!
-    struct prom_2labeled_var *parent_var; // variable being labeled
-    const char *label2;			// second label string
-    // could have pointer to next ...2label_var
+// common prefix of all N label (sub)vars
+struct prom_nlabel_var {
+    struct prom_var base;		// NOTE: name is label values, comma separated!
+    struct prom_var *parent_var;	// base of variable being labeled
+    const char *rendered;		// name1="value1",...: on first use
+} PROM_ALIGN;
+
+struct prom_simple_nlabel_var {
+    struct prom_var base;		// NOTE: name is label values!
+    struct prom_var *parent_var;	// base of variable being labeled
+    const char *rendered;		// name1="value1",...: on first use
     prom_value value;
+    prom_value *valp;			// &value, or slot in mapped memory
 } PROM_ALIGN;
 
-struct prom_getter_2label_var {
-    struct prom_var base;		// NOTE: name is label string!
-    struct prom_2labeled_var *parent_var; // variable being labeled
-    const char *label2;			// second label string
-    // could have pointer to next ...2label_var
+struct prom_getter_nlabel_var {
+    struct prom_var base;		// NOTE: name is label values!
+    struct prom_var *parent_var;	// base of variable being labeled
+    const char *rendered;		// name1="value1",...: on first use
     double (*getter)(void);
 } PROM_ALIGN;
 
+// **************** counter array: one label, values indexed at runtime
+
+#define PROM_CACHE_LINE 64
+
+// one slot per cache line: no false sharing between indices
+struct prom_counter_slot {
+    prom_value value;
+} __attribute__((aligned(PROM_CACHE_LINE)));
+
+struct prom_counter_array_var {
+    struct prom_var base;
+    const char *label;
+    int n;				// number of slots
+    const char *const *values;		// label values[n]
+    struct prom_counter_slot *slots;	// slots[n]
+    const char **rendered;		// {label="value"}[n], on first format
+} PROM_ALIGN;
+
+// **************** histograms with labels
+
+// labeled histograms: children share the family's limits,
+// and their bins are allocated in one array on first use
+struct prom_hist_layout {
+    int nbins;			// not including +inf
+    double *limits;		// double[nbins]
+    prom_value *bins;		// prom_value[nchildren][nbins+1]
+    double *sums;		// double[nchildren]
+    int nchildren;
+};
+
+struct prom_labeled_hist_var {
+    struct prom_labeled_var labeled;	// format is prom_format_labeled
+    struct prom_hist_layout layout;
+} PROM_ALIGN;
+
+struct prom_nlabeled_hist_var {
+    struct prom_nlabeled_var labeled;	// format is prom_format_nlabeled
+    struct prom_hist_layout layout;
+} PROM_ALIGN;
+
+struct prom_hist_label_var {
+    struct prom_var base;		// NOTE: name is label string(s)!
+    struct prom_var *parent_var;	// base of family being labeled
+    const char *rendered;		// N labels: as in prom_nlabel_var
+    struct prom_hist_layout *layout;
+    prom_value *bins;			// in layout->bins, or mapped memory
+    double *sump;			// in layout->sums, or mapped memory
+} PROM_ALIGN;
+
 // ********************************
 extern time_t prom_now;			// set by prom_format_vars
 #define STALE(T) ((T) == 0 || (prom_now - (T)) > 10)
 
 int prom_format_simple(PROM_FILE *f, struct prom_var *pvp);
 int prom_format_getter(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_async(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_double_gauge(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_fixed_gauge(PROM_FILE *f, struct prom_var *pvp);
 int prom_format_histogram(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_int_histogram(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_histogram_label(PROM_FILE *f, struct prom_var *pvp);
 int prom_format_labeled(PROM_FILE *f, struct prom_var *pvp);
 int prom_format_simple_label(PROM_FILE *f, struct prom_var *pvp);
 int prom_format_getter_label(PROM_FILE *f, struct prom_var *pvp);
-int prom_format_2labeled(PROM_FILE *f, struct prom_var *pvp);
-int prom_format_simple_2label(PROM_FILE *f, struct prom_var *pvp);
-int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_nlabeled(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_simple_nlabel(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_getter_nlabel(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_counter_array(PROM_FILE *f, struct prom_var *pvp);
 
 // all prom_vars end up contiguous in a loader segment
 #define PROM_SECTION_NAME prometheus
@@ -196,6 +306,61 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
 #define PROM_SECTION_ATTR \
     __attribute__((section (PROM_SECTION_PREFIX PROM_SECTION_STR)))
 
+// count (1..8) variadic macro args, and paste them together (with __)
+#define _PROM_CAT(A,B) _PROM_CAT2(A,B)
+#define _PROM_CAT2(A,B) A##B
+#define _PROM_NARGS(...) _PROM_NARGS2(__VA_ARGS__,8,7,6,5,4,3,2,1,0)
+#define _PROM_NARGS2(_1,_2,_3,_4,_5,_6,_7,_8,N,...) N
+#define _PROM_JOIN(...) \
+    _PROM_CAT(_PROM_JOIN_,_PROM_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define _PROM_JOIN_1(A) A
+#define _PROM_JOIN_2(A,B) A##__##B
+#define _PROM_JOIN_3(A,B,C) A##__##B##__##C
+#define _PROM_JOIN_4(A,B,C,D) A##__##B##__##C##__##D
+#define _PROM_JOIN_5(A,B,C,D,E) A##__##B##__##C##__##D##__##E
+#define _PROM_JOIN_6(A,B,C,D,E,F) A##__##B##__##C##__##D##__##E##__##F
+#define _PROM_JOIN_7(A,B,C,D,E,F,G) A##__##B##__##C##__##D##__##E##__##F##__##G
+#define _PROM_JOIN_8(A,B,C,D,E,F,G,H) \
+    A##__##B##__##C##__##D##__##E##__##F##__##G##__##H
+
+////////////////////////////////////////////////////////////////
+// N labels (shared by COUNTERs, GAUGEs and HISTOGRAMs):
+// label names are strings, label values are tokens (as for one label);
+// the full label set of each value is rendered once, on first use.
+
+#define _PROM_NLABELS_NAME(NAME) PROM_NLABELS_##NAME
+
+// family VAR with label names LABELS...
+#define _PROM_NLABELED_VAR(VAR,TYPE,NAME,HELP,...) \
+    _PROM_NS(NAME); \
+    static const char *const _PROM_NLABELS_NAME(NAME)[] = { __VA_ARGS__ }; \
+    struct prom_nlabeled_var VAR PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_nlabeled_var), TYPE, \
+	    #NAME, HELP, prom_format_nlabeled, PROM_VAR_CHEAP }, \
+	  sizeof(_PROM_NLABELS_NAME(NAME))/sizeof(char *), \
+	  _PROM_NLABELS_NAME(NAME) }
+
+// compile time check that N values were given for family NAME
+#define _PROM_NLABEL_CHECK(NAME,VAR,N) \
+    typedef char _PROM_CAT(VAR,__CHECK) \
+	[sizeof(_PROM_NLABELS_NAME(NAME))/sizeof(char *) == (N) ? 1 : -1]
+
+// "simple" value VAR of FAMILY (declared as NAME), VALUES is a string
+#define _PROM_SIMPLE_NLABEL(FAMILY,NAME,VAR,VALUES,N) \
+    _PROM_NLABEL_CHECK(NAME,VAR,N); \
+    struct prom_simple_nlabel_var VAR PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_simple_nlabel_var), LABEL, \
+	    VALUES, NULL, prom_format_simple_nlabel, PROM_VAR_CHEAP }, \
+	  &FAMILY.base, NULL, 0, &VAR.value }
+
+// "getter" value VAR of FAMILY: FN must already be declared
+#define _PROM_GETTER_NLABEL(FAMILY,NAME,VAR,VALUES,N,FN) \
+    _PROM_NLABEL_CHECK(NAME,VAR,N); \
+    struct prom_getter_nlabel_var VAR PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_getter_nlabel_var), LABEL, \
+	    VALUES, NULL, prom_format_getter_nlabel, 0 }, \
+	  &FAMILY.base, NULL, FN }
+
 ////////////////////////////////////////////////////////////////
 // COUNTERs:
 
@@ -205,15 +370,16 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
 // (prevent decrement of counters and increment on non-simple vars)
 #define _PROM_SIMPLE_COUNTER_NAME(NAME) PROM_SIMPLE_COUNTER_##NAME
 #define _PROM_GETTER_COUNTER_NAME(NAME) PROM_GETTER_COUNTER_##NAME
+#define _PROM_ASYNC_COUNTER_NAME(NAME) PROM_ASYNC_COUNTER_##NAME
 #define _PROM_FORMAT_COUNTER_NAME(NAME) PROM_FORMAT_COUNTER_##NAME
 #define _PROM_LABELED_COUNTER_NAME(NAME) PROM_LABELED_COUNTER_##NAME
 #define _PROM_SIMPLE_COUNTER_LABEL_NAME(NAME,LABEL) PROM_SIMPLE_COUNTER_##NAME##__LABEL__##LABEL
 #define _PROM_GETTER_COUNTER_LABEL_NAME(NAME,LABEL) PROM_GETTER_COUNTER_##NAME##__LABEL__##LABEL
-#define _PROM_2LABELED_COUNTER_NAME(NAME) PROM_2LABELED_COUNTER_##NAME
-#define _PROM_SIMPLE_COUNTER_2LABEL_NAME(NAME,LABEL1,LABEL2) \
-    PROM_SIMPLE_COUNTER_##NAME##__LABEL1__##LABEL1##__LABEL2__##LABEL2
-#define _PROM_GETTER_COUNTER_2LABEL_NAME(NAME,LABEL1,LABEL2) \
-    PROM_GETTER_COUNTER_##NAME##__LABEL1__##LABEL1##__LABEL2__##LABEL2
+#define _PROM_NLABELED_COUNTER_NAME(NAME) PROM_NLABELED_COUNTER_##NAME
+#define _PROM_SIMPLE_COUNTER_NLABEL_NAME(NAME,...) \
+    _PROM_CAT(PROM_SIMPLE_COUNTER_##NAME##__NLABEL__, _PROM_JOIN(__VA_ARGS__))
+#define _PROM_GETTER_COUNTER_NLABEL_NAME(NAME,...) \
+    _PROM_CAT(PROM_GETTER_COUNTER_##NAME##__NLABEL__, _PROM_JOIN(__VA_ARGS__))
 
 // avoids multiple declarations of same name with different type/class
 // (cause ld error)
@@ -223,7 +389,10 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
 #define PROM_GETTER_COUNTER_FN_NAME(NAME) NAME##_getter
 #define PROM_FORMAT_COUNTER_FN_NAME(NAME) NAME##_format
 #define PROM_GETTER_COUNTER_LABEL_FN_NAME(NAME,LABEL) NAME##_LABEL_##LABEL##_getter
-#define PROM_GETTER_COUNTER_2LABEL_FN_NAME(NAME,LABEL1,LABEL2) NAME##_LABEL1_##LABEL1##__LABEL2__##LABEL2##_getter
+#define PROM_GETTER_COUNTER_NLABEL_FN_NAME(NAME,...) \
+    _PROM_CAT(NAME##_NLABEL_, _PROM_CAT(_PROM_JOIN(__VA_ARGS__), _getter))
+#define PROM_GETTER_COUNTER_2LABEL_FN_NAME(NAME,LABEL1,LABEL2) \
+    PROM_GETTER_COUNTER_NLABEL_FN_NAME(NAME,LABEL1,LABEL2)
 
 // use to create functions!!
 #define PROM_GETTER_COUNTER_FN_PROTO(NAME) \
@@ -236,8 +405,11 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
 #define PROM_GETTER_COUNTER_LABEL_FN_PROTO(NAME,LABEL) \
     static double PROM_GETTER_COUNTER_LABEL_FN_NAME(NAME,LABEL)(void)
 
+#define PROM_GETTER_COUNTER_NLABEL_FN_PROTO(NAME,...) \
+    static double PROM_GETTER_COUNTER_NLABEL_FN_NAME(NAME,__VA_ARGS__)(void)
+
 #define PROM_GETTER_COUNTER_2LABEL_FN_PROTO(NAME,LABEL1,LABEL2) \
-    static double PROM_GETTER_COUNTER_2LABEL_FN_NAME(NAME,LABEL1,LABEL2)(void)
+    PROM_GETTER_COUNTER_NLABEL_FN_PROTO(NAME,LABEL1,LABEL2)
 
 ////////////////
 // declare a simple counter
@@ -245,14 +417,15 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     _PROM_NS(NAME); \
     struct prom_simple_var _PROM_SIMPLE_COUNTER_NAME(NAME) PROM_SECTION_ATTR = \
 	{ { sizeof(struct prom_simple_var), COUNTER, \
-	  #NAME, HELP, prom_format_simple }, 0 }
+	  #NAME, HELP, prom_format_simple, PROM_VAR_CHEAP }, \
+	  0, &_PROM_SIMPLE_COUNTER_NAME(NAME).value }
 
 // ONLY work on "simple" counters
 #define PROM_SIMPLE_COUNTER_INC(NAME) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_COUNTER_NAME(NAME).value, 1)
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_COUNTER_NAME(NAME).valp, 1)
 
 #define PROM_SIMPLE_COUNTER_INC_BY(NAME,BY) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_COUNTER_NAME(NAME).value, BY)
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_COUNTER_NAME(NAME).valp, BY)
 
 ////////////////
 // declare counter with function to fetch (non-decreasing) value
@@ -261,13 +434,28 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     PROM_GETTER_COUNTER_FN_PROTO(NAME); \
     struct prom_getter_var _PROM_GETTER_COUNTER_NAME(NAME) PROM_SECTION_ATTR = \
 	{ { sizeof(struct prom_getter_var), COUNTER, #NAME, HELP, \
-	  prom_format_getter }, PROM_GETTER_COUNTER_FN_NAME(NAME) }
+	  prom_format_getter, 0 }, PROM_GETTER_COUNTER_FN_NAME(NAME) }
 
 // declare var & function in one swell foop
 #define PROM_GETTER_COUNTER_FN(NAME,HELP) \
     PROM_GETTER_COUNTER(NAME,HELP); \
     PROM_GETTER_COUNTER_FN_PROTO(NAME)
 
+////////////////
+// declare counter with (expensive) function to fetch value
+// run by prom_collector_init thread; scrapes return the last value
+#define PROM_ASYNC_GETTER_COUNTER(NAME,HELP) \
+    _PROM_NS(NAME); \
+    PROM_GETTER_COUNTER_FN_PROTO(NAME); \
+    struct prom_async_var _PROM_ASYNC_COUNTER_NAME(NAME) PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_async_var), COUNTER, #NAME, HELP, \
+	  prom_format_async, PROM_VAR_ASYNC }, PROM_GETTER_COUNTER_FN_NAME(NAME), 0, 0 }
+
+// declare var & function in one swell foop
+#define PROM_ASYNC_GETTER_COUNTER_FN(NAME,HELP) \
+    PROM_ASYNC_GETTER_COUNTER(NAME,HELP); \
+    PROM_GETTER_COUNTER_FN_PROTO(NAME)
+
 ////////////////
 // declare a counter with a function to format names (typ. w/ labels)
 // use PROM_FORMAT_COUNTER_FN_PROTO(NAME) { ...... } to declare
@@ -276,7 +464,7 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     PROM_FORMAT_COUNTER_FN_PROTO(NAME); \
     struct prom_var _PROM_FORMAT_COUNTER_NAME(NAME) PROM_SECTION_ATTR = \
 	{ sizeof(struct prom_var), COUNTER, \
-	  #NAME, HELP, PROM_FORMAT_COUNTER_FN_NAME(NAME) }
+	  #NAME, HELP, PROM_FORMAT_COUNTER_FN_NAME(NAME), PROM_VAR_SPARSE }
 
 // declare var & function:
 #define PROM_FORMAT_COUNTER_FN(NAME,HELP) \
@@ -286,18 +474,15 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
 ////////////////
 // declare counter with a single label name, and a static set of values.
 
-// If output order needs to be tightly controlled
-// could declare declare label subvars in a special segment, and have
-// a (single) initializer function run thru the special segment,
-// putting the labels into a linked list attached to the main var, and
-// have the formatter for the main var iterate over the list,
-// formatting the var/labels/values....
+// Label subvars can land anywhere in the section:
+// prom_format_vars groups them under their parent (see prom_index.c),
+// in label value order.
 
 #define PROM_LABELED_COUNTER(NAME,LABEL,HELP) \
     _PROM_NS(NAME); \
     struct prom_labeled_var _PROM_LABELED_COUNTER_NAME(NAME) PROM_SECTION_ATTR = \
 	{ { sizeof(struct prom_labeled_var), COUNTER, \
-	  #NAME, HELP, prom_format_labeled }, LABEL }
+	  #NAME, HELP, prom_format_labeled, PROM_VAR_CHEAP }, LABEL }
 
 ////////
 // declare a label on a PROM_LABELED_COUNTER with a "simple" value
@@ -305,14 +490,15 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
 #define PROM_SIMPLE_COUNTER_LABEL(NAME,LABEL_) \
     struct prom_simple_label_var _PROM_SIMPLE_COUNTER_LABEL_NAME(NAME,LABEL_) PROM_SECTION_ATTR =	\
 	{ { sizeof(struct prom_simple_label_var), LABEL, \
-	    #LABEL_, NULL, prom_format_simple_label }, &_PROM_LABELED_COUNTER_NAME(NAME), 0 }
+	    #LABEL_, NULL, prom_format_simple_label, PROM_VAR_CHEAP }, &_PROM_LABELED_COUNTER_NAME(NAME), \
+	  0, &_PROM_SIMPLE_COUNTER_LABEL_NAME(NAME,LABEL_).value }
 
 // ONLY work on "simple" counters
 #define PROM_SIMPLE_COUNTER_LABEL_INC(NAME,LABEL) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_COUNTER_LABEL_NAME(NAME,LABEL).value, 1)
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_COUNTER_LABEL_NAME(NAME,LABEL).valp, 1)
 
 #define PROM_SIMPLE_COUNTER_LABEL_INC_BY(NAME,LABEL,BY) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_COUNTER_LABEL_NAME(NAME,LABEL).value, BY)
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_COUNTER_LABEL_NAME(NAME,LABEL).valp, BY)
 
 ////////
 // declare a label on a PROM_LABELED_COUNTER with a "getter" value
@@ -321,7 +507,7 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     PROM_GETTER_COUNTER_LABEL_FN_PROTO(NAME,LABEL_); \
     struct prom_getter_label_var _PROM_GETTER_COUNTER_LABEL_NAME(NAME,LABEL_) PROM_SECTION_ATTR = \
 	{ { sizeof(struct prom_getter_label_var), LABEL, \
-	    #LABEL_, NULL, prom_format_getter_label }, \
+	    #LABEL_, NULL, prom_format_getter_label, 0 }, \
 	  &_PROM_LABELED_COUNTER_NAME(NAME), \
 	  PROM_GETTER_COUNTER_LABEL_FN_NAME(NAME,LABEL_) }
 
@@ -331,45 +517,96 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     PROM_GETTER_COUNTER_LABEL_FN_PROTO(NAME,LABEL_)
 
 ////////////////
-// declare counter with a two label names, and a static set of values.
+// declare counter with N label names (strings), and a static set of values.
 
-#define PROM_2LABELED_COUNTER(NAME,LABEL1,LABEL2,HELP) \
-    _PROM_NS(NAME); \
-    struct prom_2labeled_var _PROM_2LABELED_COUNTER_NAME(NAME) PROM_SECTION_ATTR = \
-	{ { sizeof(struct prom_2labeled_var), COUNTER, \
-	  #NAME, HELP, prom_format_2labeled }, LABEL1, LABEL2 }
+#define PROM_NLABELED_COUNTER(NAME,HELP,...) \
+    _PROM_NLABELED_VAR(_PROM_NLABELED_COUNTER_NAME(NAME),COUNTER,NAME,HELP,__VA_ARGS__)
 
 ////////
-// declare labels on a PROM_2LABELED_COUNTER with a "simple" value
+// declare values (one token per label name) on a PROM_NLABELED_COUNTER
+// with a "simple" value
 
-#define PROM_SIMPLE_COUNTER_2LABEL(NAME, LABEL1, LABEL2) \
-    struct prom_simple_2label_var _PROM_SIMPLE_COUNTER_2LABEL_NAME(NAME,LABEL1,LABEL2) PROM_SECTION_ATTR = \
-	{ { sizeof(struct prom_simple_2label_var), LABEL, \
-	    #LABEL1, NULL, prom_format_simple_2label }, \
-	  &_PROM_2LABELED_COUNTER_NAME(NAME), #LABEL2, 0 }
+#define PROM_SIMPLE_COUNTER_NLABEL(NAME,...) \
+    _PROM_SIMPLE_NLABEL(_PROM_NLABELED_COUNTER_NAME(NAME), NAME, \
+			_PROM_SIMPLE_COUNTER_NLABEL_NAME(NAME,__VA_ARGS__), \
+			#__VA_ARGS__, _PROM_NARGS(__VA_ARGS__))
 
 // ONLY work on "simple" counters
-#define PROM_SIMPLE_COUNTER_2LABEL_INC(NAME,LABEL1, LABEL2) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_COUNTER_2LABEL_NAME(NAME,LABEL1,LABEL2).value, 1)
+#define PROM_SIMPLE_COUNTER_NLABEL_INC(NAME,...) \
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_COUNTER_NLABEL_NAME(NAME,__VA_ARGS__).valp, 1)
 
-#define PROM_SIMPLE_COUNTER_2LABEL_INC_BY(NAME,LABEL1,LABEL2,BY) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_COUNTER_2LABEL_NAME(NAME,LABEL1,LABEL2).value, BY)
+#define PROM_SIMPLE_COUNTER_NLABEL_INC_BY(NAME,BY,...) \
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_COUNTER_NLABEL_NAME(NAME,__VA_ARGS__).valp, BY)
 
 ////////
-// declare a label on a PROM_2LABELED_COUNTER with a "getter" value
+// declare values on a PROM_NLABELED_COUNTER with a "getter" value
+#define PROM_GETTER_COUNTER_NLABEL(NAME,...) \
+    PROM_GETTER_COUNTER_NLABEL_FN_PROTO(NAME,__VA_ARGS__); \
+    _PROM_GETTER_NLABEL(_PROM_NLABELED_COUNTER_NAME(NAME), NAME, \
+			_PROM_GETTER_COUNTER_NLABEL_NAME(NAME,__VA_ARGS__), \
+			#__VA_ARGS__, _PROM_NARGS(__VA_ARGS__), \
+			PROM_GETTER_COUNTER_NLABEL_FN_NAME(NAME,__VA_ARGS__))
+
+// declare var & function in one line:
+#define PROM_GETTER_COUNTER_NLABEL_FN(NAME,...) \
+    PROM_GETTER_COUNTER_NLABEL(NAME,__VA_ARGS__); \
+    PROM_GETTER_COUNTER_NLABEL_FN_PROTO(NAME,__VA_ARGS__)
+
+////////////////
+// declare counter with two label names, and a static set of values.
+// (N labels, with 2LABEL macros taking values before BY/VAL)
+
+#define PROM_2LABELED_COUNTER(NAME,LABEL1,LABEL2,HELP) \
+    PROM_NLABELED_COUNTER(NAME,HELP,LABEL1,LABEL2)
+
+#define PROM_SIMPLE_COUNTER_2LABEL(NAME,LABEL1,LABEL2) \
+    _PROM_SIMPLE_NLABEL(_PROM_NLABELED_COUNTER_NAME(NAME), NAME, \
+			_PROM_SIMPLE_COUNTER_NLABEL_NAME(NAME,LABEL1,LABEL2), \
+			#LABEL1 ", " #LABEL2, 2)
+
+#define PROM_SIMPLE_COUNTER_2LABEL_INC(NAME,LABEL1,LABEL2) \
+    PROM_SIMPLE_COUNTER_NLABEL_INC(NAME,LABEL1,LABEL2)
+
+#define PROM_SIMPLE_COUNTER_2LABEL_INC_BY(NAME,LABEL1,LABEL2,BY) \
+    PROM_SIMPLE_COUNTER_NLABEL_INC_BY(NAME,BY,LABEL1,LABEL2)
+
 #define PROM_GETTER_COUNTER_2LABEL(NAME,LABEL1,LABEL2) \
     PROM_GETTER_COUNTER_2LABEL_FN_PROTO(NAME,LABEL1,LABEL2); \
-    struct prom_getter_2label_var _PROM_GETTER_COUNTER_2LABEL_NAME(NAME,LABEL1,LABEL2) PROM_SECTION_ATTR = \
-	{ { sizeof(struct prom_getter_2label_var), LABEL, \
-	    #LABEL1, NULL, prom_format_getter_2label }, \
-	  &_PROM_2LABELED_COUNTER_NAME(NAME), #LABEL2, \
-	  PROM_GETTER_COUNTER_2LABEL_FN_NAME(NAME,LABEL1, LABEL2) }
+    _PROM_GETTER_NLABEL(_PROM_NLABELED_COUNTER_NAME(NAME), NAME, \
+			_PROM_GETTER_COUNTER_NLABEL_NAME(NAME,LABEL1,LABEL2), \
+			#LABEL1 ", " #LABEL2, 2, \
+			PROM_GETTER_COUNTER_2LABEL_FN_NAME(NAME,LABEL1,LABEL2))
 
-// declare var & function in one line:
 #define PROM_GETTER_COUNTER_2LABEL_FN(NAME,LABEL1,LABEL2) \
     PROM_GETTER_COUNTER_2LABEL(NAME,LABEL1,LABEL2); \
     PROM_GETTER_COUNTER_2LABEL_FN_PROTO(NAME,LABEL1,LABEL2)
 
+////////////////
+// declare counter with a single label name, and N values indexed
+// (at runtime) 0..N-1; VALUES is an array of N label value strings:
+//	static const char *const shards[] = { "a", "b", "c" };
+//	PROM_COUNTER_ARRAY(shard_requests_total, "shard", 3, shards, "help");
+//	PROM_COUNTER_ARRAY_INC(shard_requests_total, i);
+// index is checked by assert (so not when compiled with -DNDEBUG)
+#define _PROM_COUNTER_ARRAY_NAME(NAME) PROM_COUNTER_ARRAY_##NAME
+#define _PROM_COUNTER_ARRAY_SLOTS_NAME(NAME) PROM_COUNTER_ARRAY_SLOTS_##NAME
+
+#define PROM_COUNTER_ARRAY(NAME,LABEL,N,VALUES,HELP) \
+    _PROM_NS(NAME); \
+    typedef char PROM_COUNTER_ARRAY_CHECK_##NAME \
+	[sizeof(VALUES)/sizeof(VALUES[0]) == (N) ? 1 : -1]; \
+    struct prom_counter_slot _PROM_COUNTER_ARRAY_SLOTS_NAME(NAME)[N]; \
+    struct prom_counter_array_var _PROM_COUNTER_ARRAY_NAME(NAME) PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_counter_array_var), COUNTER, \
+	    #NAME, HELP, prom_format_counter_array, PROM_VAR_CHEAP }, \
+	  LABEL, N, VALUES, _PROM_COUNTER_ARRAY_SLOTS_NAME(NAME), NULL }
+
+#define PROM_COUNTER_ARRAY_INC_BY(NAME,IDX,BY) do { \
+	assert((size_t)(IDX) < (size_t)_PROM_COUNTER_ARRAY_NAME(NAME).n); \
+	PROM_ATOMIC_INCREMENT(_PROM_COUNTER_ARRAY_SLOTS_NAME(NAME)[IDX].value, BY); \
+    } while (0)
+
+#define PROM_COUNTER_ARRAY_INC(NAME,IDX) PROM_COUNTER_ARRAY_INC_BY(NAME,IDX,1)
 
 ////////////////////////////////////////////////////////////////
 // GAUGEs:
@@ -381,21 +618,28 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
 // *BUT* allows multiple declaration of same metric name with different types!
 #define _PROM_SIMPLE_GAUGE_NAME(NAME) PROM_SIMPLE_GAUGE_##NAME
 #define _PROM_GETTER_GAUGE_NAME(NAME) PROM_GETTER_GAUGE_##NAME
+#define _PROM_ASYNC_GAUGE_NAME(NAME) PROM_ASYNC_GAUGE_##NAME
 #define _PROM_FORMAT_GAUGE_NAME(NAME) PROM_FORMAT_GAUGE_##NAME
+#define _PROM_DOUBLE_GAUGE_NAME(NAME) PROM_DOUBLE_GAUGE_##NAME
+#define _PROM_FIXED_GAUGE_NAME(NAME) PROM_FIXED_GAUGE_##NAME
+#define _PROM_FIXED_GAUGE_SCALE_NAME(NAME) PROM_FIXED_GAUGE_SCALE_##NAME
 #define _PROM_LABELED_GAUGE_NAME(NAME) PROM_LABELED_GAUGE_##NAME
 #define _PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL) PROM_SIMPLE_GAUGE_##NAME##__LABEL__##LABEL
 #define _PROM_GETTER_GAUGE_LABEL_NAME(NAME,LABEL) PROM_GETTER_GAUGE_##NAME##__LABEL__##LABEL
-#define _PROM_2LABELED_GAUGE_NAME(NAME) PROM_2LABELED_GAUGE_##NAME
-#define _PROM_SIMPLE_GAUGE_2LABEL_NAME(NAME,LABEL1,LABEL2) \
-    PROM_SIMPLE_GAUGE_##NAME##__LABEL1__##LABEL1##__LABEL2__##LABEL2
-#define _PROM_GETTER_GAUGE_2LABEL_NAME(NAME,LABEL1,LABEL2) \
-    PROM_GETTER_GAUGE_##NAME##__LABEL1__##LABEL1##__LABEL2__##LABEL2
+#define _PROM_NLABELED_GAUGE_NAME(NAME) PROM_NLABELED_GAUGE_##NAME
+#define _PROM_SIMPLE_GAUGE_NLABEL_NAME(NAME,...) \
+    _PROM_CAT(PROM_SIMPLE_GAUGE_##NAME##__NLABEL__, _PROM_JOIN(__VA_ARGS__))
+#define _PROM_GETTER_GAUGE_NLABEL_NAME(NAME,...) \
+    _PROM_CAT(PROM_GETTER_GAUGE_##NAME##__NLABEL__, _PROM_JOIN(__VA_ARGS__))
 
 // use to create functions!!
 #define PROM_GETTER_GAUGE_FN_NAME(NAME) NAME##_getter
 #define PROM_FORMAT_GAUGE_FN_NAME(NAME) NAME##_format
 #define PROM_GETTER_GAUGE_LABEL_FN_NAME(NAME,LABEL) NAME##_LABEL_##LABEL##_getter
-#define PROM_GETTER_GAUGE_2LABEL_FN_NAME(NAME,LABEL1,LABEL2) NAME##_LABEL1_##LABEL1##__LABEL2__##LABEL2##_getter
+#define PROM_GETTER_GAUGE_NLABEL_FN_NAME(NAME,...) \
+    _PROM_CAT(NAME##_NLABEL_, _PROM_CAT(_PROM_JOIN(__VA_ARGS__), _getter))
+#define PROM_GETTER_GAUGE_2LABEL_FN_NAME(NAME,LABEL1,LABEL2) \
+    PROM_GETTER_GAUGE_NLABEL_FN_NAME(NAME,LABEL1,LABEL2)
 
 #define PROM_GETTER_GAUGE_FN_PROTO(NAME) \
     static double PROM_GETTER_GAUGE_FN_NAME(NAME)(void)
@@ -406,8 +650,11 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
 #define PROM_GETTER_GAUGE_LABEL_FN_PROTO(NAME,LABEL) \
     static double PROM_GETTER_GAUGE_LABEL_FN_NAME(NAME,LABEL)(void)
 
+#define PROM_GETTER_GAUGE_NLABEL_FN_PROTO(NAME,...) \
+    static double PROM_GETTER_GAUGE_NLABEL_FN_NAME(NAME,__VA_ARGS__)(void)
+
 #define PROM_GETTER_GAUGE_2LABEL_FN_PROTO(NAME,LABEL1,LABEL2) \
-    static double PROM_GETTER_GAUGE_2LABEL_FN_NAME(NAME,LABEL1,LABEL2)(void)
+    PROM_GETTER_GAUGE_NLABEL_FN_PROTO(NAME,LABEL1,LABEL2)
 
 ////////////////
 // declare a simple gauge
@@ -415,20 +662,115 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     _PROM_NS(NAME); \
     struct prom_simple_var _PROM_SIMPLE_GAUGE_NAME(NAME) PROM_SECTION_ATTR = \
 	{ { sizeof(struct prom_simple_var), GAUGE, \
-	    #NAME,HELP, prom_format_simple}, 0 }
+	    #NAME,HELP, prom_format_simple, PROM_VAR_CHEAP}, \
+	  0, &_PROM_SIMPLE_GAUGE_NAME(NAME).value }
 
 // ONLY work on "simple" gauges
 #define PROM_SIMPLE_GAUGE_INC(NAME) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_GAUGE_NAME(NAME).value, 1)
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_GAUGE_NAME(NAME).valp, 1)
 
 #define PROM_SIMPLE_GAUGE_INC_BY(NAME,BY) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_GAUGE_NAME(NAME).value, BY)
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_GAUGE_NAME(NAME).valp, BY)
 
 #define PROM_SIMPLE_GAUGE_DEC(NAME) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_GAUGE_NAME(NAME).value, -1)
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_GAUGE_NAME(NAME).valp, -1)
 
 #define PROM_SIMPLE_GAUGE_SET(NAME, VAL) \
-    _PROM_SIMPLE_GAUGE_NAME(NAME).value = VAL
+    *_PROM_SIMPLE_GAUGE_NAME(NAME).valp = VAL
+
+////////////////
+// declare a gauge with a double value (ie; ratios, seconds, temperatures)
+// set, add, max and min are lock free
+#define PROM_DOUBLE_GAUGE(NAME,HELP) \
+    _PROM_NS(NAME); \
+    struct prom_double_gauge_var _PROM_DOUBLE_GAUGE_NAME(NAME) PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_double_gauge_var), GAUGE, \
+	    #NAME, HELP, prom_format_double_gauge, PROM_VAR_CHEAP }, 0.0 }
+
+#ifdef NO_THREADS
+#define _PROM_DBL_LOAD(DP,VP) (*(VP) = *(DP))
+#define _PROM_DBL_STORE(DP,VP) (*(DP) = *(VP))
+#define _PROM_DBL_CAS(DP,OLDP,NEWP) (*(DP) = *(NEWP), 1)
+#else
+// compares (and on failure, reloads *OLDP) by bit pattern
+#define _PROM_DBL_LOAD(DP,VP) __atomic_load(DP, VP, __ATOMIC_RELAXED)
+#define _PROM_DBL_STORE(DP,VP) __atomic_store(DP, VP, __ATOMIC_RELAXED)
+#define _PROM_DBL_CAS(DP,OLDP,NEWP) \
+    __atomic_compare_exchange(DP, OLDP, NEWP, 1, \
+			      __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#endif
+
+static inline double
+prom_double_load(double *dp) {
+    double value;
+
+    _PROM_DBL_LOAD(dp, &value);
+    return value;
+}
+
+static inline void
+prom_double_set(double *dp, double value) {
+    _PROM_DBL_STORE(dp, &value);
+}
+
+static inline void
+prom_double_add(double *dp, double value) {
+    double old, sum;
+
+    _PROM_DBL_LOAD(dp, &old);
+    do
+	sum = old + value;
+    while (!_PROM_DBL_CAS(dp, &old, &sum));
+}
+
+static inline void
+prom_double_max(double *dp, double value) {
+    double old;
+
+    _PROM_DBL_LOAD(dp, &old);
+    while (value > old && !_PROM_DBL_CAS(dp, &old, &value))
+	;
+}
+
+static inline void
+prom_double_min(double *dp, double value) {
+    double old;
+
+    _PROM_DBL_LOAD(dp, &old);
+    while (value < old && !_PROM_DBL_CAS(dp, &old, &value))
+	;
+}
+
+#define PROM_DOUBLE_GAUGE_SET(NAME,VAL) \
+    prom_double_set(&_PROM_DOUBLE_GAUGE_NAME(NAME).value, VAL)
+#define PROM_DOUBLE_GAUGE_ADD(NAME,VAL) \
+    prom_double_add(&_PROM_DOUBLE_GAUGE_NAME(NAME).value, VAL)
+#define PROM_DOUBLE_GAUGE_MAX(NAME,VAL) \
+    prom_double_max(&_PROM_DOUBLE_GAUGE_NAME(NAME).value, VAL)
+#define PROM_DOUBLE_GAUGE_MIN(NAME,VAL) \
+    prom_double_min(&_PROM_DOUBLE_GAUGE_NAME(NAME).value, VAL)
+
+////////////////
+// declare a fixed point gauge: SCALE is an integer constant (ie; 1000
+// for thousandths); values are rounded to 1/SCALE, and add is a
+// single atomic integer add
+#define PROM_FIXED_GAUGE(NAME,HELP,SCALE) \
+    _PROM_NS(NAME); \
+    enum { _PROM_FIXED_GAUGE_SCALE_NAME(NAME) = (SCALE) }; \
+    struct prom_fixed_gauge_var _PROM_FIXED_GAUGE_NAME(NAME) PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_fixed_gauge_var), GAUGE, \
+	    #NAME, HELP, prom_format_fixed_gauge, PROM_VAR_CHEAP }, 0, SCALE }
+
+// VAL in units of 1/scale (rounded)
+#define _PROM_FIXED_GAUGE_UNITS(NAME,VAL) \
+    ((long long)((VAL) * _PROM_FIXED_GAUGE_SCALE_NAME(NAME) + \
+		 ((VAL) < 0 ? -0.5 : 0.5)))
+
+#define PROM_FIXED_GAUGE_SET(NAME,VAL) \
+    (_PROM_FIXED_GAUGE_NAME(NAME).value = _PROM_FIXED_GAUGE_UNITS(NAME,VAL))
+#define PROM_FIXED_GAUGE_ADD(NAME,VAL) \
+    PROM_ATOMIC_INCREMENT(_PROM_FIXED_GAUGE_NAME(NAME).value, \
+			  _PROM_FIXED_GAUGE_UNITS(NAME,VAL))
 
 ////////////////
 // declare gauge with function to fetch (non-decreasing) value
@@ -437,13 +779,28 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     PROM_GETTER_GAUGE_FN_PROTO(NAME); \
     struct prom_getter_var _PROM_GETTER_GAUGE_NAME(NAME) PROM_SECTION_ATTR = \
 	{ { sizeof(struct prom_getter_var), GAUGE, #NAME, HELP, \
-	  prom_format_getter }, PROM_GETTER_GAUGE_FN_NAME(NAME) }
+	  prom_format_getter, 0 }, PROM_GETTER_GAUGE_FN_NAME(NAME) }
 
 // declare var and function in one line:
 #define PROM_GETTER_GAUGE_FN(NAME,HELP) \
     PROM_GETTER_GAUGE(NAME,HELP); \
     PROM_GETTER_GAUGE_FN_PROTO(NAME)
 
+////////////////
+// declare gauge with (expensive) function to fetch value
+// run by prom_collector_init thread; scrapes return the last value
+#define PROM_ASYNC_GETTER_GAUGE(NAME,HELP) \
+    _PROM_NS(NAME); \
+    PROM_GETTER_GAUGE_FN_PROTO(NAME); \
+    struct prom_async_var _PROM_ASYNC_GAUGE_NAME(NAME) PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_async_var), GAUGE, #NAME, HELP, \
+	  prom_format_async, PROM_VAR_ASYNC }, PROM_GETTER_GAUGE_FN_NAME(NAME), 0, 0 }
+
+// declare var and function in one line:
+#define PROM_ASYNC_GETTER_GAUGE_FN(NAME,HELP) \
+    PROM_ASYNC_GETTER_GAUGE(NAME,HELP); \
+    PROM_GETTER_GAUGE_FN_PROTO(NAME)
+
 ////////////////
 // declare a gauge with a function to format names (typ. w/ labels)
 // use PROM_FORMAT_GAUGE_FN_PROTO(NAME) { ...... } to declare
@@ -452,7 +809,7 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     PROM_FORMAT_GAUGE_FN_PROTO(NAME); \
     struct prom_var _PROM_FORMAT_GAUGE_NAME(NAME) PROM_SECTION_ATTR = \
 	{ sizeof(struct prom_var), GAUGE, \
-	  #NAME, HELP, PROM_FORMAT_GAUGE_FN_NAME(NAME) }
+	  #NAME, HELP, PROM_FORMAT_GAUGE_FN_NAME(NAME), PROM_VAR_SPARSE }
 
 // declare var and function:
 #define PROM_FORMAT_GAUGE_FN(NAME,HELP) \
@@ -466,7 +823,7 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     _PROM_NS(NAME); \
     struct prom_labeled_var _PROM_LABELED_GAUGE_NAME(NAME) PROM_SECTION_ATTR = \
 	{ { sizeof(struct prom_labeled_var), GAUGE, \
-	  #NAME, HELP, prom_format_labeled }, LABEL }
+	  #NAME, HELP, prom_format_labeled, PROM_VAR_CHEAP }, LABEL }
 
 ////////
 // declare a label on a PROM_LABELED_GAUGE with a "simple" value
@@ -474,20 +831,21 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
 #define PROM_SIMPLE_GAUGE_LABEL(NAME,LABEL_) \
     struct prom_simple_label_var _PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL_) PROM_SECTION_ATTR =	\
 	{ { sizeof(struct prom_simple_label_var), LABEL, \
-	    #LABEL_, NULL, prom_format_simple_label }, &_PROM_LABELED_GAUGE_NAME(NAME), 0 }
+	    #LABEL_, NULL, prom_format_simple_label, PROM_VAR_CHEAP }, &_PROM_LABELED_GAUGE_NAME(NAME), \
+	  0, &_PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL_).value }
 
 // ONLY work on "simple" gauges
 #define PROM_SIMPLE_GAUGE_LABEL_INC(NAME,LABEL) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL).value, 1)
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL).valp, 1)
 
 #define PROM_SIMPLE_GAUGE_LABEL_INC_BY(NAME,LABEL,BY) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL).value, BY)
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL).valp, BY)
 
 #define PROM_SIMPLE_GAUGE_LABEL_DEC(NAME,LABEL) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL).value, -1)
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL).valp, -1)
 
 #define PROM_SIMPLE_GAUGE_LABEL_SET(NAME,LABEL,VAL) \
-    _PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL).value = VAL
+    *_PROM_SIMPLE_GAUGE_LABEL_NAME(NAME,LABEL).valp = VAL
 
 ////////
 // declare a label on a PROM_LABELED_GAUGE with a "getter" value
@@ -496,7 +854,7 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     PROM_GETTER_GAUGE_LABEL_FN_PROTO(NAME,LABEL_); \
     struct prom_getter_label_var _PROM_GETTER_GAUGE_LABEL_NAME(NAME,LABEL_) PROM_SECTION_ATTR = \
 	{ { sizeof(struct prom_getter_label_var), LABEL, \
-	    #LABEL_, NULL, prom_format_getter_label }, \
+	    #LABEL_, NULL, prom_format_getter_label, 0 }, \
 	  &_PROM_LABELED_GAUGE_NAME(NAME), \
 	  PROM_GETTER_GAUGE_LABEL_FN_NAME(NAME,LABEL_) }
 
@@ -506,44 +864,78 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     PROM_GETTER_GAUGE_LABEL_FN_PROTO(NAME,LABEL_)
 
 ////////////////
-// declare counter with a two label names, and a static set of values.
+// declare gauge with N label names (strings), and a static set of values.
 
-#define PROM_2LABELED_GAUGE(NAME,LABEL1,LABEL2,HELP) \
-    _PROM_NS(NAME); \
-    struct prom_2labeled_var _PROM_2LABELED_GAUGE_NAME(NAME) PROM_SECTION_ATTR = \
-	{ { sizeof(struct prom_2labeled_var), GAUGE, \
-	  #NAME, HELP, prom_format_2labeled }, LABEL1, LABEL2 }
+#define PROM_NLABELED_GAUGE(NAME,HELP,...) \
+    _PROM_NLABELED_VAR(_PROM_NLABELED_GAUGE_NAME(NAME),GAUGE,NAME,HELP,__VA_ARGS__)
 
 ////////
-// declare labels on a PROM_2LABELED_GAUGE with a "simple" value
+// declare values (one token per label name) on a PROM_NLABELED_GAUGE
+// with a "simple" value
 
-#define PROM_SIMPLE_GAUGE_2LABEL(NAME, LABEL1, LABEL2) \
-    struct prom_simple_2label_var _PROM_SIMPLE_GAUGE_2LABEL_NAME(NAME,LABEL1,LABEL2) PROM_SECTION_ATTR = \
-	{ { sizeof(struct prom_simple_2label_var), LABEL, \
-	    #LABEL1, NULL, prom_format_simple_2label }, \
-	  &_PROM_2LABELED_GAUGE_NAME(NAME), #LABEL2, 0 }
+#define PROM_SIMPLE_GAUGE_NLABEL(NAME,...) \
+    _PROM_SIMPLE_NLABEL(_PROM_NLABELED_GAUGE_NAME(NAME), NAME, \
+			_PROM_SIMPLE_GAUGE_NLABEL_NAME(NAME,__VA_ARGS__), \
+			#__VA_ARGS__, _PROM_NARGS(__VA_ARGS__))
 
 // ONLY work on "simple" gauges
-#define PROM_SIMPLE_GAUGE_2LABEL_INC(NAME,LABEL1, LABEL2) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_GAUGE_2LABEL_NAME(NAME,LABEL1,LABEL2).value, 1)
+#define PROM_SIMPLE_GAUGE_NLABEL_INC(NAME,...) \
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_GAUGE_NLABEL_NAME(NAME,__VA_ARGS__).valp, 1)
 
-#define PROM_SIMPLE_GAUGE_2LABEL_INC_BY(NAME,LABEL1,LABEL2,BY) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_GAUGE_2LABEL_NAME(NAME,LABEL1,LABEL2).value, BY)
+#define PROM_SIMPLE_GAUGE_NLABEL_INC_BY(NAME,BY,...) \
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_GAUGE_NLABEL_NAME(NAME,__VA_ARGS__).valp, BY)
+
+#define PROM_SIMPLE_GAUGE_NLABEL_DEC(NAME,...) \
+    PROM_ATOMIC_INCREMENT(*_PROM_SIMPLE_GAUGE_NLABEL_NAME(NAME,__VA_ARGS__).valp, -1)
 
-#define PROM_SIMPLE_GAUGE_2LABEL_DEC(NAME,LABEL1, LABEL2) \
-    PROM_ATOMIC_INCREMENT(_PROM_SIMPLE_GAUGE_2LABEL_NAME(NAME,LABEL1,LABEL2).value, -1)
+#define PROM_SIMPLE_GAUGE_NLABEL_SET(NAME,VAL,...) \
+    *_PROM_SIMPLE_GAUGE_NLABEL_NAME(NAME,__VA_ARGS__).valp = VAL
 
 ////////
-// declare a label on a PROM_2LABELED_GAUGE with a "getter" value
+// declare values on a PROM_NLABELED_GAUGE with a "getter" value
+#define PROM_GETTER_GAUGE_NLABEL(NAME,...) \
+    PROM_GETTER_GAUGE_NLABEL_FN_PROTO(NAME,__VA_ARGS__); \
+    _PROM_GETTER_NLABEL(_PROM_NLABELED_GAUGE_NAME(NAME), NAME, \
+			_PROM_GETTER_GAUGE_NLABEL_NAME(NAME,__VA_ARGS__), \
+			#__VA_ARGS__, _PROM_NARGS(__VA_ARGS__), \
+			PROM_GETTER_GAUGE_NLABEL_FN_NAME(NAME,__VA_ARGS__))
+
+// declare var & function in one line:
+#define PROM_GETTER_GAUGE_NLABEL_FN(NAME,...) \
+    PROM_GETTER_GAUGE_NLABEL(NAME,__VA_ARGS__); \
+    PROM_GETTER_GAUGE_NLABEL_FN_PROTO(NAME,__VA_ARGS__)
+
+////////////////
+// declare gauge with two label names, and a static set of values.
+// (N labels, with 2LABEL macros taking values before BY/VAL)
+
+#define PROM_2LABELED_GAUGE(NAME,LABEL1,LABEL2,HELP) \
+    PROM_NLABELED_GAUGE(NAME,HELP,LABEL1,LABEL2)
+
+#define PROM_SIMPLE_GAUGE_2LABEL(NAME,LABEL1,LABEL2) \
+    _PROM_SIMPLE_NLABEL(_PROM_NLABELED_GAUGE_NAME(NAME), NAME, \
+			_PROM_SIMPLE_GAUGE_NLABEL_NAME(NAME,LABEL1,LABEL2), \
+			#LABEL1 ", " #LABEL2, 2)
+
+#define PROM_SIMPLE_GAUGE_2LABEL_INC(NAME,LABEL1,LABEL2) \
+    PROM_SIMPLE_GAUGE_NLABEL_INC(NAME,LABEL1,LABEL2)
+
+#define PROM_SIMPLE_GAUGE_2LABEL_INC_BY(NAME,LABEL1,LABEL2,BY) \
+    PROM_SIMPLE_GAUGE_NLABEL_INC_BY(NAME,BY,LABEL1,LABEL2)
+
+#define PROM_SIMPLE_GAUGE_2LABEL_DEC(NAME,LABEL1,LABEL2) \
+    PROM_SIMPLE_GAUGE_NLABEL_DEC(NAME,LABEL1,LABEL2)
+
+#define PROM_SIMPLE_GAUGE_2LABEL_SET(NAME,LABEL1,LABEL2,VAL) \
+    PROM_SIMPLE_GAUGE_NLABEL_SET(NAME,VAL,LABEL1,LABEL2)
+
 #define PROM_GETTER_GAUGE_2LABEL(NAME,LABEL1,LABEL2) \
     PROM_GETTER_GAUGE_2LABEL_FN_PROTO(NAME,LABEL1,LABEL2); \
-    struct prom_getter_2label_var _PROM_GETTER_GAUGE_2LABEL_NAME(NAME,LABEL1,LABEL2) PROM_SECTION_ATTR = \
-	{ { sizeof(struct prom_getter_2label_var), LABEL, \
-	    #LABEL1, NULL, prom_format_getter_2label }, \
-	  &_PROM_2LABELED_GAUGE_NAME(NAME), #LABEL2, \
-	  PROM_GETTER_GAUGE_2LABEL_FN_NAME(NAME,LABEL1, LABEL2) }
+    _PROM_GETTER_NLABEL(_PROM_NLABELED_GAUGE_NAME(NAME), NAME, \
+			_PROM_GETTER_GAUGE_NLABEL_NAME(NAME,LABEL1,LABEL2), \
+			#LABEL1 ", " #LABEL2, 2, \
+			PROM_GETTER_GAUGE_2LABEL_FN_NAME(NAME,LABEL1,LABEL2))
 
-// declare var & function in one line:
 #define PROM_GETTER_GAUGE_2LABEL_FN(NAME,LABEL1,LABEL2) \
     PROM_GETTER_GAUGE_2LABEL(NAME,LABEL1,LABEL2); \
     PROM_GETTER_GAUGE_2LABEL_FN_PROTO(NAME,LABEL1,LABEL2)
@@ -557,30 +949,318 @@ int prom_format_getter_2label(PROM_FILE *f, struct prom_var *pvp);
     _PROM_NS(NAME); \
     struct prom_hist_var _PROM_HISTOGRAM_NAME(NAME) PROM_SECTION_ATTR = \
 	{ {sizeof(struct prom_hist_var), HISTOGRAM, \
-	   #NAME, HELP, prom_format_histogram }, \
-	  sizeof(LIMITS)/sizeof(LIMITS[0]), LIMITS, NULL, 0, 0.0 }
+	   #NAME, HELP, prom_format_histogram, PROM_VAR_CHEAP }, \
+	  sizeof(LIMITS)/sizeof(LIMITS[0]), LIMITS, NULL, \
+	  &_PROM_HISTOGRAM_NAME(NAME).sum, 0.0, 0, NULL }
 
 // histogram with default limits
 #define PROM_HISTOGRAM(NAME,HELP) \
     _PROM_NS(NAME); \
     struct prom_hist_var _PROM_HISTOGRAM_NAME(NAME) PROM_SECTION_ATTR = \
 	{ { sizeof(struct prom_hist_var), HISTOGRAM, \
-	  #NAME, HELP, prom_format_histogram }, \
-	  0, NULL, NULL, 0, 0.0 }
+	  #NAME, HELP, prom_format_histogram, PROM_VAR_CHEAP }, \
+	  0, NULL, NULL, &_PROM_HISTOGRAM_NAME(NAME).sum, 0.0, 0, NULL }
 
 extern int prom_histogram_observe(struct prom_hist_var *, double value);
+#define PROM_HISTOGRAM_VAR(NAME) _PROM_HISTOGRAM_NAME(NAME)
 #define PROM_HISTOGRAM_OBSERVE(NAME,VALUE) \
     prom_histogram_observe(&_PROM_HISTOGRAM_NAME(NAME), VALUE)
 
+////////////////
+// declare histogram with a single label name, and a static set of values.
+#define _PROM_LABELED_HISTOGRAM_NAME(NAME) PROM_LABELED_HISTOGRAM_##NAME
+#define _PROM_HISTOGRAM_LABEL_NAME(NAME,LABEL) \
+    PROM_HISTOGRAM_##NAME##__LABEL__##LABEL
+
+// custom limits
+#define PROM_LABELED_HISTOGRAM_CUSTOM(NAME,LABEL,HELP,LIMITS) \
+    _PROM_NS(NAME); \
+    struct prom_labeled_hist_var _PROM_LABELED_HISTOGRAM_NAME(NAME) PROM_SECTION_ATTR = \
+	{ { { sizeof(struct prom_labeled_hist_var), HISTOGRAM, \
+	      #NAME, HELP, prom_format_labeled, PROM_VAR_CHEAP }, LABEL }, \
+	  { sizeof(LIMITS)/sizeof(LIMITS[0]), LIMITS, NULL, NULL, 0 } }
+
+// default limits
+#define PROM_LABELED_HISTOGRAM(NAME,LABEL,HELP) \
+    _PROM_NS(NAME); \
+    struct prom_labeled_hist_var _PROM_LABELED_HISTOGRAM_NAME(NAME) PROM_SECTION_ATTR = \
+	{ { { sizeof(struct prom_labeled_hist_var), HISTOGRAM, \
+	      #NAME, HELP, prom_format_labeled, PROM_VAR_CHEAP }, LABEL }, \
+	  { 0, NULL, NULL, NULL, 0 } }
+
+// declare a label on a PROM_LABELED_HISTOGRAM
+#define PROM_HISTOGRAM_LABEL(NAME,LABEL_) \
+    struct prom_hist_label_var _PROM_HISTOGRAM_LABEL_NAME(NAME,LABEL_) PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_hist_label_var), LABEL, \
+	    #LABEL_, NULL, prom_format_histogram_label, PROM_VAR_CHEAP }, \
+	  &_PROM_LABELED_HISTOGRAM_NAME(NAME).labeled.base, NULL, \
+	  &_PROM_LABELED_HISTOGRAM_NAME(NAME).layout, NULL, NULL }
+
+extern int prom_histogram_label_observe(struct prom_hist_label_var *,
+					double value);
+#define PROM_HISTOGRAM_LABEL_OBSERVE(NAME,LABEL,VALUE) \
+    prom_histogram_label_observe(&_PROM_HISTOGRAM_LABEL_NAME(NAME,LABEL), VALUE)
+
+////////////////
+// declare histogram with N label names (strings), and a static set of values.
+#define _PROM_NLABELED_HISTOGRAM_NAME(NAME) PROM_NLABELED_HISTOGRAM_##NAME
+#define _PROM_HISTOGRAM_NLABEL_NAME(NAME,...) \
+    _PROM_CAT(PROM_HISTOGRAM_##NAME##__NLABEL__, _PROM_JOIN(__VA_ARGS__))
+
+#define _PROM_NLABELED_HISTOGRAM(NAME,HELP,NBINS,LIMITS,...) \
+    _PROM_NS(NAME); \
+    static const char *const _PROM_NLABELS_NAME(NAME)[] = { __VA_ARGS__ }; \
+    struct prom_nlabeled_hist_var _PROM_NLABELED_HISTOGRAM_NAME(NAME) PROM_SECTION_ATTR = \
+	{ { { sizeof(struct prom_nlabeled_hist_var), HISTOGRAM, \
+	      #NAME, HELP, prom_format_nlabeled, PROM_VAR_CHEAP }, \
+	    sizeof(_PROM_NLABELS_NAME(NAME))/sizeof(char *), \
+	    _PROM_NLABELS_NAME(NAME) }, \
+	  { NBINS, LIMITS, NULL, NULL, 0 } }
+
+// custom limits
+#define PROM_NLABELED_HISTOGRAM_CUSTOM(NAME,HELP,LIMITS,...) \
+    _PROM_NLABELED_HISTOGRAM(NAME,HELP,sizeof(LIMITS)/sizeof(LIMITS[0]), \
+			     LIMITS,__VA_ARGS__)
+
+// default limits
+#define PROM_NLABELED_HISTOGRAM(NAME,HELP,...) \
+    _PROM_NLABELED_HISTOGRAM(NAME,HELP,0,NULL,__VA_ARGS__)
+
+#define _PROM_HISTOGRAM_NLABEL(NAME,VAR,VALUES,N) \
+    _PROM_NLABEL_CHECK(NAME,VAR,N); \
+    struct prom_hist_label_var VAR PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_hist_label_var), LABEL, \
+	    VALUES, NULL, prom_format_histogram_label, PROM_VAR_CHEAP }, \
+	  &_PROM_NLABELED_HISTOGRAM_NAME(NAME).labeled.base, NULL, \
+	  &_PROM_NLABELED_HISTOGRAM_NAME(NAME).layout, NULL, NULL }
+
+// declare values (one token per label name) on a PROM_NLABELED_HISTOGRAM
+#define PROM_HISTOGRAM_NLABEL(NAME,...) \
+    _PROM_HISTOGRAM_NLABEL(NAME, _PROM_HISTOGRAM_NLABEL_NAME(NAME,__VA_ARGS__), \
+			   #__VA_ARGS__, _PROM_NARGS(__VA_ARGS__))
+
+#define PROM_HISTOGRAM_NLABEL_OBSERVE(NAME,VALUE,...) \
+    prom_histogram_label_observe( \
+	&_PROM_HISTOGRAM_NLABEL_NAME(NAME,__VA_ARGS__), VALUE)
+
+////////////////
+// declare histogram with two label names, and a static set of values.
+
+// custom limits
+#define PROM_2LABELED_HISTOGRAM_CUSTOM(NAME,LABEL1,LABEL2,HELP,LIMITS) \
+    PROM_NLABELED_HISTOGRAM_CUSTOM(NAME,HELP,LIMITS,LABEL1,LABEL2)
+
+// default limits
+#define PROM_2LABELED_HISTOGRAM(NAME,LABEL1,LABEL2,HELP) \
+    PROM_NLABELED_HISTOGRAM(NAME,HELP,LABEL1,LABEL2)
+
+// declare labels on a PROM_2LABELED_HISTOGRAM
+#define PROM_HISTOGRAM_2LABEL(NAME,LABEL1,LABEL2) \
+    _PROM_HISTOGRAM_NLABEL(NAME, _PROM_HISTOGRAM_NLABEL_NAME(NAME,LABEL1,LABEL2), \
+			   #LABEL1 ", " #LABEL2, 2)
+
+#define PROM_HISTOGRAM_2LABEL_OBSERVE(NAME,LABEL1,LABEL2,VALUE) \
+    PROM_HISTOGRAM_NLABEL_OBSERVE(NAME,VALUE,LABEL1,LABEL2)
+
+////////////////
+// integer histogram (ie; sizes, lengths, depths): PROM_INT_HISTOGRAM_OBSERVE
+// takes a long long, and buckets have limits 2^MIN_POW .. 2^MAX_POW
+// (0 <= MIN_POW <= MAX_POW <= 62): no floating point, no search.
+#define _PROM_INT_HISTOGRAM_BINS_NAME(NAME) PROM_INT_HISTOGRAM_BINS_##NAME
+
+#define PROM_INT_HISTOGRAM(NAME,HELP,MIN_POW,MAX_POW) \
+    _PROM_NS(NAME); \
+    prom_value _PROM_INT_HISTOGRAM_BINS_NAME(NAME)[(MAX_POW)-(MIN_POW)+2]; \
+    struct prom_int_hist_var _PROM_HISTOGRAM_NAME(NAME) PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_int_hist_var), HISTOGRAM, \
+	  #NAME, HELP, prom_format_int_histogram, PROM_VAR_CHEAP }, \
+	  MIN_POW, MAX_POW, _PROM_INT_HISTOGRAM_BINS_NAME(NAME), 0 }
+
+static inline void
+prom_int_histogram_observe(struct prom_int_hist_var *pihvp, long long value) {
+    // bucket is ceil(log2(value)) - min_pow, clamped (last is +Inf)
+    int i = (value <= 1 ? 0 : 64 - __builtin_clzll(value - 1)) - pihvp->min_pow;
+
+    if (i < 0)
+	i = 0;
+    else if (i > pihvp->max_pow - pihvp->min_pow)
+	i = pihvp->max_pow - pihvp->min_pow + 1;
+    PROM_ATOMIC_INCREMENT(pihvp->bins[i], 1);
+    PROM_ATOMIC_INCREMENT(pihvp->sum, value);
+}
+
+#define PROM_INT_HISTOGRAM_OBSERVE(NAME,VALUE) \
+    prom_int_histogram_observe(&_PROM_HISTOGRAM_NAME(NAME), VALUE)
+
+////////////////
+// time a block of code into a histogram (in seconds):
+//	PROM_HISTOGRAM_TIME_START(name);
+//	....
+//	PROM_HISTOGRAM_TIME_STOP(name);
+// reads the TSC on x86 (if invariant), else CLOCK_MONOTONIC (ns);
+// ticks are compared to limits converted once, and the sum is
+// converted to seconds when scraped.
+
+extern int prom_tick_tsc;		// >0: TSC, <0: clock_gettime
+extern int prom_tick_calibrated;	// prom_tick_seconds() is final
+extern long long prom_ticks_slow(void);
+extern double prom_tick_seconds(void);	// seconds per tick (calibrated)
+
+static inline long long
+prom_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (prom_tick_tsc > 0)
+	return (long long)__builtin_ia32_rdtsc();
+#endif
+    return prom_ticks_slow();
+}
+
+extern int prom_histogram_observe_ticks(struct prom_hist_var *, long long);
+
+#define _PROM_HISTOGRAM_START_NAME(NAME) prom_histogram_start_##NAME
+
+#define PROM_HISTOGRAM_TIME_START(NAME) \
+    long long _PROM_HISTOGRAM_START_NAME(NAME) = prom_ticks()
+
+#define PROM_HISTOGRAM_TIME_STOP(NAME) \
+    prom_histogram_observe_ticks(&_PROM_HISTOGRAM_NAME(NAME), \
+				 prom_ticks() - _PROM_HISTOGRAM_START_NAME(NAME))
+
+////////////////////////////////////////////////////////////////
+// instrumented mutexes: an uncontended lock is a pthread_mutex_trylock;
+// only when that fails is the wait timed, and recorded in
+// prom_mutex_wait_seconds{mutex="NAME"} and
+// prom_mutex_contended_total{mutex="NAME"}.
+// PROM_MUTEX_HOLD also records prom_mutex_hold_seconds{mutex="NAME"}
+// (costs a clock read on every lock and unlock).
+
+#ifndef NO_THREADS
+#include <pthread.h>
+
+#ifdef PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+#define PROM_MUTEX_INIT PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+#else
+#define PROM_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
+
+#define PROM_MUTEX_NBINS 11		// not including +Inf
+
+struct prom_mutex {
+    pthread_mutex_t mutex;
+    int hold;				// record hold times
+    long long locked;			// ns when acquired (if hold)
+    // per-bucket (not cumulative) counts; last is +Inf
+    prom_value wait_bins[PROM_MUTEX_NBINS+1];
+    prom_value wait_ns;			// sum of waits
+    prom_value hold_bins[PROM_MUTEX_NBINS+1];
+    prom_value hold_ns;			// sum of hold times
+};
+
+struct prom_mutex_label_var {
+    struct prom_var base;		// NOTE: name is label string!
+    struct prom_labeled_var *parent_var; // family being labeled
+    struct prom_mutex *pmp;
+} PROM_ALIGN;
+
+// families (in prom_mutex.c)
+extern struct prom_labeled_var prom_mutex_contended_family;
+extern struct prom_labeled_var prom_mutex_wait_family;
+extern struct prom_labeled_var prom_mutex_hold_family;
+
+int prom_format_mutex_contended(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_mutex_wait(PROM_FILE *f, struct prom_var *pvp);
+int prom_format_mutex_hold(PROM_FILE *f, struct prom_var *pvp);
+
+extern int prom_mutex_lock_slow(struct prom_mutex *);
+extern void prom_mutex_locked(struct prom_mutex *);
+extern void prom_mutex_unlocking(struct prom_mutex *);
+
+static inline int
+prom_mutex_lock(struct prom_mutex *pmp) {
+    int ret = pthread_mutex_trylock(&pmp->mutex);
+
+    if (ret != 0)
+	ret = prom_mutex_lock_slow(pmp);
+    if (ret == 0 && pmp->hold)
+	prom_mutex_locked(pmp);
+    return ret;
+}
+
+static inline int
+prom_mutex_unlock(struct prom_mutex *pmp) {
+    if (pmp->hold)
+	prom_mutex_unlocking(pmp);
+    return pthread_mutex_unlock(&pmp->mutex);
+}
+
+#define _PROM_MUTEX_NAME(NAME) PROM_MUTEX_##NAME
+#define _PROM_MUTEX_LABEL_NAME(NAME,FAMILY) PROM_MUTEX_##NAME##__##FAMILY
+
+// for internal use only
+#define _PROM_MUTEX_LABEL(CLASS,NAME,FAMILY) \
+    CLASS struct prom_mutex_label_var _PROM_MUTEX_LABEL_NAME(NAME,FAMILY) \
+	__attribute__((used)) PROM_SECTION_ATTR = \
+	{ { sizeof(struct prom_mutex_label_var), LABEL, \
+	    #NAME, NULL, prom_format_mutex_##FAMILY, PROM_VAR_CHEAP }, \
+	  &prom_mutex_##FAMILY##_family, &_PROM_MUTEX_NAME(NAME) }
+
+// CLASS is empty or static (ie; for a mutex local to a function)
+#define _PROM_MUTEX(CLASS,NAME,HOLD) \
+    CLASS struct prom_mutex _PROM_MUTEX_NAME(NAME) = \
+	{ PROM_MUTEX_INIT, HOLD, 0, { 0 }, 0, { 0 }, 0 }; \
+    _PROM_MUTEX_LABEL(CLASS,NAME,contended); \
+    _PROM_MUTEX_LABEL(CLASS,NAME,wait); \
+    _PROM_MUTEX_LABEL(CLASS,NAME,hold)
+
+#define PROM_MUTEX(NAME) _PROM_MUTEX(,NAME,0)
+#define PROM_MUTEX_HOLD(NAME) _PROM_MUTEX(,NAME,1)
+
+#define PROM_MUTEX_LOCK(NAME) prom_mutex_lock(&_PROM_MUTEX_NAME(NAME))
+#define PROM_MUTEX_UNLOCK(NAME) prom_mutex_unlock(&_PROM_MUTEX_NAME(NAME))
+#endif // NO_THREADS
+
 ////////////////////////////////////////////////////////////////
 // public interface:
 
 extern const char *prom_namespace;	// must include trailing '_'
 
 extern int prom_process_init(void);	// call to load process exporter
+extern int prom_process_cache_ms;	// reuse /proc data (Linux)
+extern int prom_smaps_cache_ms;		// smaps_rollup (Linux; zero: off)
+extern int prom_threads_init(void);	// load per-thread metrics (Linux)
+extern int prom_threads_cache_ms;	// reuse /proc/self/task walk (Linux)
+extern int prom_cgroup_init(void);	// load cgroup v2 metrics (Linux)
+extern int prom_perf_init(void);	// load perf_event counters (Linux)
+extern int prom_collector_init(int interval); // start async getter thread
+extern int prom_eval_init(int threads);	// start parallel format threads
+extern int prom_mark_slow(const char *name); // format family in parallel
+extern int prom_shm_init(int nprocs);	// share values with forked children
+extern int prom_mmap_init(const char *path); // publish values in a file
+extern int prom_mmap_persist(const char *path); // ... and restore at start
+extern int prom_textfile_write(const char *dir, const char *name);
+extern int prom_textfile_init(const char *dir, const char *name, int interval);
+extern int prom_remote_write_label(const char *name, const char *value);
+extern int prom_remote_write_init(const char *url, int interval);
+#define PROM_STATSD_TAGS 1			// labels as DogStatsD tags
+extern int prom_statsd_init(const char *host, const char *port,
+			    int flags, int interval);
+extern int prom_statsd_flush(void);	// send (counter deltas)
 extern int prom_http_request(PROM_FILE *in, PROM_FILE *out, const char *who);
 extern int prom_format_vars(PROM_FILE *f);
 
+// select families by exported name (including prom_namespace)
+struct prom_filter {
+    const char *name;
+    int prefix;				// non-zero to match name as prefix
+};
+extern int prom_format_vars_filtered(PROM_FILE *f,
+				     const struct prom_filter *filters,
+				     int nfilters);
+// filters optional (nfilters may be zero), timeout in seconds (zero for none)
+extern int prom_format_vars_timeout(PROM_FILE *f,
+				    const struct prom_filter *filters,
+				    int nfilters, double timeout);
+
 // helpers for formatters:
 extern int prom_format_start(PROM_FILE *f, int *state, struct prom_var *pvp);
 extern int prom_format_label(PROM_FILE *f, int *state, const char *name,
@@ -589,6 +1269,8 @@ extern int prom_format_label(PROM_FILE *f, int *state, const char *name,
 extern int prom_format_value(PROM_FILE *f, int *state, const char *format, ...)
     __attribute__ ((__format__ (__printf__, 3, 4)));
 extern int prom_format_value_pv(PROM_FILE *f, int *state, prom_value value);
+// pre-rendered name1="value1",... (no braces)
+extern int prom_format_labels(PROM_FILE *f, int *state, const char *rendered);
 extern int prom_format_value_dbl(PROM_FILE *f, int *state, double value);
 
 // network helpers
@@ -608,3 +1290,23 @@ void prom_http_unavail(int s);
 #ifdef __cplusplus
 } // extern "C"
 #endif
+
+#ifdef __cplusplus
+namespace prom {
+// time the enclosing scope into a histogram:
+//	prom::ScopedTimer timer(PROM_HISTOGRAM_VAR(name));
+class ScopedTimer {
+public:
+    explicit ScopedTimer(struct prom_hist_var &hist)
+	: hist_(hist), start_(prom_ticks()) {}
+    ~ScopedTimer() {
+	prom_histogram_observe_ticks(&hist_, prom_ticks() - start_);
+    }
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+private:
+    struct prom_hist_var &hist_;
+    long long start_;
+};
+} // namespace prom
+#endif
@@ -0,0 +1,344 @@
+// cgroup v2 resource and pressure (PSI) metrics for Linux
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Call prom_cgroup_init() to load.  Finds the process's cgroup
+// (from /proc/self/cgroup and the cgroup2 mount in mountinfo),
+// opens the files below once, and rereads them with pread at most
+// every prom_process_cache_ms.  Files that don't exist (ie; memory.max
+// in the root cgroup, or a controller not enabled) produce no output
+// (FORMAT families with no samples have no TYPE/HELP lines either).
+
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <math.h>			/* INFINITY */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prom.h"
+#include "common.h"
+
+enum {
+    CPU_STAT,
+    MEMORY_CURRENT,
+    MEMORY_MAX,
+    MEMORY_EVENTS,
+    CPU_PRESSURE,
+    MEMORY_PRESSURE,
+    IO_PRESSURE,
+    NFILES
+};
+
+static struct cg_file {
+    const char *name;
+    int fd;				// -1 if not open
+    ssize_t len;			// data in buf (or -1)
+    char buf[1024];
+} files[NFILES] = {
+    { "cpu.stat", -1, -1, "" },
+    { "memory.current", -1, -1, "" },
+    { "memory.max", -1, -1, "" },
+    { "memory.events", -1, -1, "" },
+    { "cpu.pressure", -1, -1, "" },
+    { "memory.pressure", -1, -1, "" },
+    { "io.pressure", -1, -1, "" },
+};
+
+static char cgroup_dir[1024];		// empty if not found
+static long long last_read;
+
+DECLARE_LOCK(cgroup_lock);
+
+static long long
+now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// find cgroup2 directory of this process; returns negative if none
+static int
+find_cgroup(void) {
+    char line[1024], path[512], mount[256], root[256];
+    const char *rel;
+    FILE *f;
+
+    path[0] = mount[0] = '\0';
+    f = fopen("/proc/self/cgroup", "r");
+    if (!f)
+	return -1;
+    while (fgets(line, sizeof(line), f))
+	if (strncmp(line, "0::", 3) == 0) { // unified hierarchy
+	    sscanf(line + 3, "%511[^\n]", path);
+	    break;
+	}
+    fclose(f);
+    if (!path[0])
+	return -1;
+
+    f = fopen("/proc/self/mountinfo", "r");
+    if (!f)
+	return -1;
+    // ID PARENT MAJ:MIN ROOT MOUNTPOINT OPTIONS... - FSTYPE ...
+    while (fgets(line, sizeof(line), f)) {
+	const char *sep = strstr(line, " - ");
+
+	if (sep && strncmp(sep + 3, "cgroup2 ", 8) == 0 &&
+	    sscanf(line, "%*s %*s %*s %255s %255s", root, mount) == 2)
+	    break;
+	mount[0] = '\0';
+    }
+    fclose(f);
+    if (!mount[0])
+	return -1;
+
+    // path is relative to the root of the mount
+    rel = path;
+    if (strcmp(root, "/") != 0 && strncmp(path, root, strlen(root)) == 0)
+	rel += strlen(root);
+    if (strcmp(rel, "/") == 0)
+	rel = "";
+    snprintf(cgroup_dir, sizeof(cgroup_dir), "%s%s", mount, rel);
+    return 0;
+}
+
+// reread all files if stale; call with cgroup_lock held
+static void
+refresh(void) {
+    long long now = now_ms();
+    int i;
+
+    if (last_read && now - last_read < prom_process_cache_ms)
+	return;
+    for (i = 0; i < NFILES; i++) {
+	struct cg_file *cfp = files + i;
+
+	if (cfp->fd < 0 && !last_read && cgroup_dir[0]) { // once only
+	    char path[1100];
+
+	    snprintf(path, sizeof(path), "%s/%s", cgroup_dir, cfp->name);
+	    cfp->fd = open(path, O_RDONLY|O_CLOEXEC);
+	}
+	cfp->len = -1;
+	if (cfp->fd >= 0)
+	    cfp->len = pread(cfp->fd, cfp->buf, sizeof(cfp->buf) - 1, 0);
+	if (cfp->len >= 0)
+	    cfp->buf[cfp->len] = '\0';
+    }
+    last_read = now;
+}
+
+// find "KEY value" line (or "KEY=value" word) in file data
+static int
+lookup(const struct cg_file *cfp, const char *start, const char *key,
+       char sep, unsigned long long *vp) {
+    size_t len = strlen(key);
+    const char *cp, *end = cfp->buf + cfp->len;
+
+    for (cp = start; (cp = strstr(cp, key)) && cp < end; cp += len)
+	if ((cp == cfp->buf || cp[-1] == '\n' || cp[-1] == ' ') &&
+	    cp[len] == sep)
+	    return prom_proc_scan_num(cp + len + 1, end, vp) != NULL;
+    return 0;
+}
+
+// output "KEY value" from a file as a single value, times SCALE
+static int
+format_key(PROM_FILE *f, struct prom_var *pvp, int file,
+	   const char *key, double scale) {
+    unsigned long long v;
+    int state, found;
+
+    LOCK(cgroup_lock);
+    refresh();
+    found = files[file].len > 0 && lookup(files + file, files[file].buf,
+					   key, ' ', &v);
+    UNLOCK(cgroup_lock);
+    if (!found)
+	return 0;
+    prom_format_start(f, &state, pvp);
+    return prom_format_value_dbl(f, &state, v * scale);
+}
+
+////////////////
+// cpu.stat
+
+PROM_FORMAT_COUNTER_FN(cgroup_cpu_usage_seconds_total,
+		       "CPU time used by the cgroup") {
+    return format_key(f, pvp, CPU_STAT, "usage_usec", 1e-6);
+}
+
+PROM_FORMAT_COUNTER_FN(cgroup_cpu_periods_total,
+		       "Enforcement periods elapsed for the cgroup CPU limit") {
+    return format_key(f, pvp, CPU_STAT, "nr_periods", 1);
+}
+
+PROM_FORMAT_COUNTER_FN(cgroup_cpu_throttled_periods_total,
+		       "Periods in which the cgroup was CPU throttled") {
+    return format_key(f, pvp, CPU_STAT, "nr_throttled", 1);
+}
+
+PROM_FORMAT_COUNTER_FN(cgroup_cpu_throttled_seconds_total,
+		       "Time the cgroup was CPU throttled") {
+    return format_key(f, pvp, CPU_STAT, "throttled_usec", 1e-6);
+}
+
+////////////////
+// memory
+
+// single value file
+static int
+format_value(PROM_FILE *f, struct prom_var *pvp, int file) {
+    const struct cg_file *cfp = files + file;
+    unsigned long long v;
+    double value = 0;
+    int state, found;
+
+    LOCK(cgroup_lock);
+    refresh();
+    found = cfp->len > 0;
+    if (found && strncmp(cfp->buf, "max", 3) == 0)
+	value = INFINITY;		// no limit
+    else if (found && (found = prom_proc_scan_num(cfp->buf,
+						  cfp->buf + cfp->len, &v)
+		       != NULL))
+	value = v;
+    UNLOCK(cgroup_lock);
+    if (!found)
+	return 0;
+    prom_format_start(f, &state, pvp);
+    return prom_format_value_dbl(f, &state, value);
+}
+
+PROM_FORMAT_GAUGE_FN(cgroup_memory_current_bytes,
+		     "Memory used by the cgroup") {
+    return format_value(f, pvp, MEMORY_CURRENT);
+}
+
+PROM_FORMAT_GAUGE_FN(cgroup_memory_max_bytes,
+		     "Memory limit of the cgroup") {
+    return format_value(f, pvp, MEMORY_MAX);
+}
+
+// "event count" lines
+PROM_FORMAT_COUNTER_FN(cgroup_memory_events_total,
+		       "Memory events (ie; high, max, oom, oom_kill) in the cgroup") {
+    const struct cg_file *cfp = files + MEMORY_EVENTS;
+    char buf[sizeof(cfp->buf)];
+    const char *cp, *end;
+    int state;
+
+    LOCK(cgroup_lock);
+    refresh();
+    memcpy(buf, cfp->buf, sizeof(buf));
+    end = buf + (cfp->len > 0 ? cfp->len : 0);
+    UNLOCK(cgroup_lock);
+
+    for (cp = buf; cp < end; ) {
+	const char *sp = memchr(cp, ' ', end - cp);
+	const char *eol = memchr(cp, '\n', end - cp);
+	unsigned long long v;
+
+	if (!eol)
+	    eol = end;
+	if (sp && sp < eol && prom_proc_scan_num(sp, eol, &v)) {
+	    prom_format_start(f, &state, pvp);
+	    prom_format_label(f, &state, "event", "%.*s", (int)(sp - cp), cp);
+	    prom_format_value_pv(f, &state, v);
+	}
+	cp = eol + 1;
+    }
+    return 0;
+}
+
+////////////////
+// pressure stall information: "some|full avg10=N avg60=N avg300=N total=USEC"
+
+PROM_FORMAT_COUNTER_FN(cgroup_pressure_seconds_total,
+		       "Time some (or all) runnable tasks in the cgroup were stalled, by resource") {
+    static const struct {
+	const char *resource;
+	int file;
+    } resources[] = {
+	{ "cpu", CPU_PRESSURE },
+	{ "io", IO_PRESSURE },
+	{ "memory", MEMORY_PRESSURE },
+    };
+    static const char *kinds[] = { "full", "some" };
+    double values[3][2];
+    int found[3][2];
+    unsigned r, k;
+    int state;
+
+    LOCK(cgroup_lock);
+    refresh();
+    for (r = 0; r < 3; r++) {
+	const struct cg_file *cfp = files + resources[r].file;
+
+	for (k = 0; k < 2; k++) {
+	    const char *line;
+	    unsigned long long v;
+
+	    found[r][k] = 0;
+	    if (cfp->len <= 0 ||
+		!(line = strstr(cfp->buf, kinds[k])) ||
+		!lookup(cfp, line, "total", '=', &v))
+		continue;
+	    found[r][k] = 1;
+	    values[r][k] = v * 1e-6;
+	}
+    }
+    UNLOCK(cgroup_lock);
+
+    for (r = 0; r < 3; r++)
+	for (k = 0; k < 2; k++) {
+	    if (!found[r][k])
+		continue;
+	    prom_format_start(f, &state, pvp);
+	    prom_format_label(f, &state, "resource", "%s", resources[r].resource);
+	    prom_format_label(f, &state, "kind", "%s", kinds[k]);
+	    prom_format_value_dbl(f, &state, values[r][k]);
+	}
+    return 0;
+}
+
+////////////////
+
+// call to load this file
+// returns negative if no cgroup v2 hierarchy found
+int
+prom_cgroup_init(void) {
+    int ret;
+
+    LOCK(cgroup_lock);
+    ret = cgroup_dir[0] ? 0 : find_cgroup();
+    UNLOCK(cgroup_lock);
+    return ret;
+}
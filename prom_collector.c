@@ -0,0 +1,115 @@
+// background collection of expensive getters
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <time.h>
+#ifndef NO_THREADS
+#include <pthread.h>
+#include <sched.h>			/* SCHED_IDLE */
+#include <unistd.h>			/* sleep */
+#endif
+
+#include "prom.h"
+#include "common.h"
+
+#ifndef NO_THREADS
+static time_t last_run;			// this process only (not summed)
+
+PROM_GETTER_GAUGE_FN(promcollector_last_run_timestamp_seconds,
+		     "Time background collection of async getters last completed") {
+    return last_run;
+}
+
+static void
+prom_collect_all(void) {
+    struct prom_family *families;
+    time_t now = time(0);		// prom_now belongs to scrapes
+    int n, i;
+
+    n = prom_index(&families);
+    for (i = 0; i < n; i++) {
+	struct prom_var *pvp = families[i].pvp;
+	if (pvp->format == prom_format_async)
+	    prom_async_collect((struct prom_async_var *)pvp, now);
+    }
+    last_run = time(0);
+}
+
+static void *
+prom_collector(void *arg) {
+    (void) arg;
+
+#ifdef SCHED_IDLE
+    {
+	// only run when nothing else wants the CPU
+	struct sched_param param = { 0 };
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    }
+#endif
+    for (;;) {
+	prom_collect_all();
+	sleep(prom_collector_interval);
+    }
+    return NULL;
+}
+
+// thread doesn't survive fork: call getters inline in child
+// (until prom_collector_init is called again)
+static void
+prom_collector_child(void) {
+    prom_collector_interval = 0;
+    last_run = 0;
+}
+
+// start thread to call async getters every INTERVAL seconds
+// returns negative on failure
+int
+prom_collector_init(int interval) {
+    static int atfork;
+    pthread_t t;
+
+    if (interval <= 0 || prom_collector_interval)
+	return -1;
+    if (!atfork++)
+	pthread_atfork(NULL, NULL, prom_collector_child);
+    prom_collector_interval = interval;
+    if (pthread_create(&t, NULL, prom_collector, NULL) != 0) {
+	prom_collector_interval = 0;
+	return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
+#else // NO_THREADS
+// no thread to run getters: they're called inline by scrapes
+int
+prom_collector_init(int interval) {
+    (void) interval;
+    errno = ENOSYS;
+    return -1;
+}
+#endif // NO_THREADS
@@ -92,10 +92,31 @@ prom_pool_worker(void *arg) {
     return NULL;
 }
 
+// threads don't survive fork:
+// forget them, so child can call prom_pool_init
+static void
+prom_pool_child(void) {
+    pthread_mutex_init(&pool_lock, NULL);
+    pthread_cond_init(&pool_cv, NULL);
+    while (!QEMPTY) {			// parent's connections
+	close(queue[qrd]);
+	qrd = NEXT(qrd);
+	PROM_SIMPLE_GAUGE_DEC(promhttp_metric_handler_requests_in_flight);
+    }
+    free(pool_threads);
+    pool_threads = NULL;
+    pool_size = 0;
+    exporter_name = NULL;
+}
+
 int
 prom_pool_init(int threads, const char *name) {
+    static int atfork;
     int i;
 
+    if (!atfork++)
+	pthread_atfork(NULL, NULL, prom_pool_child);
+
     pool_threads = calloc(threads, sizeof(pthread_t));
 
     for (i = 0; i < threads; i++)
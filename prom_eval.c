@@ -0,0 +1,306 @@
+// parallel formatting of slow families during a scrape
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Families marked with prom_mark_slow are formatted into memory by
+// a small pool of threads while the scraping thread formats the rest;
+// output is assembled in the usual (name) order.  The scraping thread
+// "steals" (formats itself) any slow family no worker has started by
+// the time it gets there, so scrape time approaches that of the slowest
+// family, rather than the sum of all of them.
+//
+// Needs PROM_MEMSTREAM (defined with the default PROM_FILE).
+//
+// With a deadline, the scraper never formats slow families itself:
+// a slow family not finished by the deadline is served from the output
+// of its last completed run (if any), and counted as skipped.
+
+#include <errno.h>			/* ETIMEDOUT */
+#include <pthread.h>
+#include <stdlib.h>			/* calloc, free */
+#include <string.h>			/* memcpy */
+
+#include "prom.h"
+#include "common.h"
+
+#ifdef PROM_MEMSTREAM
+
+// job states
+#define JOB_IDLE 0
+#define JOB_BUSY 1
+#define JOB_DONE 2
+
+struct prom_eval_job {
+    struct prom_family *pfp;
+    int state;
+    char *buf;				// formatted output
+    size_t len;
+};
+
+// slow families for one scrape
+struct prom_eval_batch {
+    struct prom_eval_job *jobs;
+    int njobs;
+    int next;				// next job for a worker to look at
+    int refs;				// scraper + workers using batch
+    struct prom_eval_batch *link;	// list of active batches
+};
+
+static pthread_mutex_t eval_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t eval_work_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t eval_done_cv = PTHREAD_COND_INITIALIZER;
+static struct prom_eval_batch *batches;	// protected by eval_lock
+static int eval_threads;
+
+// only one of scraper and worker gets to run a job
+static int
+prom_eval_claim(struct prom_eval_job *jp) {
+    return __sync_bool_compare_and_swap(&jp->state, JOB_IDLE, JOB_BUSY);
+}
+
+// call with eval_lock held
+static void
+prom_eval_release(struct prom_eval_batch *bp) {
+    int i;
+
+    if (--bp->refs > 0)
+	return;
+    for (i = 0; i < bp->njobs; i++)
+	free(bp->jobs[i].buf);
+    free(bp->jobs);
+    free(bp);
+}
+
+// NUL terminated copy of LEN bytes of BUF (or NULL)
+static char *
+prom_eval_copy(const char *buf, size_t len) {
+    char *copy = malloc(len + 1);
+
+    if (copy) {
+	memcpy(copy, buf, len);
+	copy[len] = '\0';
+    }
+    return copy;
+}
+
+static void
+prom_eval_run(struct prom_eval_job *jp) {
+    struct prom_family *pfp = jp->pfp;
+    PROM_FILE *f = PROM_MEMSTREAM(&jp->buf, &jp->len);
+    char *cache = NULL;
+
+    if (f) {
+	prom_format_family(f, pfp);
+	PROM_CLOSE(f);
+    }
+    // else XXX family will be missing from output
+
+    // save a copy to serve if a later scrape runs out of time
+    if (jp->buf)
+	cache = prom_eval_copy(jp->buf, jp->len);
+
+    pthread_mutex_lock(&eval_lock);
+    if (cache) {
+	free(pfp->cache);
+	pfp->cache = cache;
+	pfp->cachelen = jp->len;
+    }
+    jp->state = JOB_DONE;
+    pthread_cond_broadcast(&eval_done_cv);
+    pthread_mutex_unlock(&eval_lock);
+}
+
+static void *
+prom_eval_worker(void *arg) {
+    (void) arg;
+
+    pthread_mutex_lock(&eval_lock);
+    for (;;) {
+	struct prom_eval_batch *bp;
+	struct prom_eval_job *jp;
+
+	for (bp = batches; bp; bp = bp->link)
+	    if (bp->next < bp->njobs)
+		break;
+	if (!bp) {
+	    pthread_cond_wait(&eval_work_cv, &eval_lock);
+	    continue;
+	}
+	jp = bp->jobs + bp->next++;
+	bp->refs++;
+	pthread_mutex_unlock(&eval_lock);
+
+	if (prom_eval_claim(jp))	// not stolen by scraper?
+	    prom_eval_run(jp);
+
+	pthread_mutex_lock(&eval_lock);
+	prom_eval_release(bp);
+    }
+    return NULL;
+}
+
+// prom_eval_hook: format selected families, slow ones in parallel
+// returns negative if nothing to do in parallel
+static int
+prom_eval_format(PROM_FILE *f, struct prom_family *families, int n,
+		 const char *marks, const struct timespec *deadline) {
+    struct prom_eval_batch *bp, **bpp;
+    struct prom_eval_job **jobmap;
+    int i, njobs;
+
+    njobs = 0;
+    for (i = 0; i < n; i++)
+	if (families[i].slow && (!marks || marks[i]))
+	    njobs++;
+    if (njobs == 0)
+	return -1;
+
+    bp = calloc(1, sizeof(*bp));
+    jobmap = calloc(n, sizeof(*jobmap));
+    if (bp)
+	bp->jobs = calloc(njobs, sizeof(*bp->jobs));
+    if (!bp || !jobmap || !bp->jobs) {
+	if (bp)
+	    free(bp->jobs);
+	free(bp);
+	free(jobmap);
+	return -1;
+    }
+
+    njobs = 0;
+    for (i = 0; i < n; i++)
+	if (families[i].slow && (!marks || marks[i])) {
+	    bp->jobs[njobs].pfp = families + i;
+	    jobmap[i] = bp->jobs + njobs++;
+	}
+    bp->njobs = njobs;
+    bp->refs = 1;
+
+    pthread_mutex_lock(&eval_lock);
+    bp->link = batches;
+    batches = bp;
+    pthread_cond_broadcast(&eval_work_cv);
+    pthread_mutex_unlock(&eval_lock);
+
+    for (i = 0; i < n; i++) {
+	struct prom_eval_job *jp = jobmap[i];
+	char *cache = NULL;
+	int done;
+
+	if (marks && !marks[i])
+	    continue;
+	if (!jp) {			// fast
+	    prom_format_family_by(f, families + i, deadline);
+	    continue;
+	}
+	if (!deadline && prom_eval_claim(jp)) { // not started: do it now
+	    prom_eval_run(jp);		// (refreshes cache)
+	    if (jp->buf)
+		PROM_PUTS(jp->buf, f);
+	    continue;
+	}
+
+	pthread_mutex_lock(&eval_lock);
+	while (jp->state != JOB_DONE) {
+	    if (!deadline)
+		pthread_cond_wait(&eval_done_cv, &eval_lock);
+	    else if (pthread_cond_timedwait(&eval_done_cv, &eval_lock,
+					    deadline) == ETIMEDOUT)
+		break;
+	}
+	done = (jp->state == JOB_DONE);
+	if (!done) {
+	    prom_eval_claim(jp);	// too late: keep workers off it
+	    if (jp->pfp->cache)
+		cache = prom_eval_copy(jp->pfp->cache, jp->pfp->cachelen);
+	}
+	pthread_mutex_unlock(&eval_lock);
+
+	if (done) {
+	    if (jp->buf)
+		PROM_PUTS(jp->buf, f);
+	}
+	else {
+	    prom_deadline_skipped();
+	    if (cache)
+		PROM_PUTS(cache, f);
+	    free(cache);
+	}
+    }
+
+    pthread_mutex_lock(&eval_lock);
+    for (bpp = &batches; *bpp != bp; bpp = &(*bpp)->link)
+	;
+    *bpp = bp->link;
+    prom_eval_release(bp);
+    pthread_mutex_unlock(&eval_lock);
+    free(jobmap);
+    return 0;
+}
+
+// threads don't survive fork: format serially in child
+// (until prom_eval_init is called again)
+static void
+prom_eval_child(void) {
+    pthread_mutex_init(&eval_lock, NULL);
+    pthread_cond_init(&eval_work_cv, NULL);
+    pthread_cond_init(&eval_done_cv, NULL);
+    batches = NULL;			// leaked
+    eval_threads = 0;
+    prom_eval_hook = NULL;
+}
+
+// start THREADS threads to format slow families
+// returns negative on failure
+int
+prom_eval_init(int threads) {
+    static int atfork;
+    int i;
+
+    if (!atfork++)
+	pthread_atfork(NULL, NULL, prom_eval_child);
+    for (i = 0; i < threads; i++) {
+	pthread_t t;
+
+	if (pthread_create(&t, NULL, prom_eval_worker, NULL) != 0)
+	    break;
+	pthread_detach(t);
+	eval_threads++;
+    }
+    if (eval_threads == 0)
+	return -1;
+    prom_eval_hook = prom_eval_format;
+    return 0;
+}
+#else // no PROM_MEMSTREAM
+// no way to format into memory: slow families are formatted serially
+int
+prom_eval_init(int threads) {
+    (void) threads;
+    errno = ENOSYS;
+    return -1;
+}
+#endif
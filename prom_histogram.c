@@ -35,7 +35,7 @@ static double default_bins[] = {
 };
 
 
-static void
+void
 prom_histogram_check(struct prom_hist_var *phvp) {
     // SHOULD be per prom_hist_var lock!
     // (but this is quick, and should only get here on startup)
@@ -48,7 +48,8 @@ prom_histogram_check(struct prom_hist_var *phvp) {
     }
     if (!phvp->bins) {
 	// XXX verify that limits are in sorted order?
-	phvp->bins = calloc(phvp->nbins, sizeof(prom_value));
+	// last bin is +Inf (count)
+	phvp->bins = calloc(phvp->nbins + 1, sizeof(prom_value));
     }
     UNLOCK(hist_check_lock);
 }
@@ -64,10 +65,10 @@ prom_histogram_observe(struct prom_hist_var *phvp, double value) {
 
     // gcc can (in theory) have _Atomic double, but it's UGLY!
     LOCK(hist_observe_lock);	// SHOULD be per-histogram!
-    phvp->sum += value;
+    *phvp->sump += value;
     UNLOCK(hist_observe_lock);
 
-    PROM_ATOMIC_INCREMENT(phvp->count, 1);
+    PROM_ATOMIC_INCREMENT(phvp->bins[phvp->nbins], 1);
 
     i = phvp->nbins;
     while (--i >= 0 && value <= phvp->limits[i])
@@ -75,35 +76,245 @@ prom_histogram_observe(struct prom_hist_var *phvp, double value) {
     return 0;
 }
 
+// convert limits to prom_ticks() units (once, with calibrated rate)
+static void
+prom_histogram_ticks_check(struct prom_hist_var *phvp) {
+    DECLARE_LOCK(hist_ticks_lock);
+    long long *tick_limits;
+    double seconds;
+    int i;
+
+    LOCK(hist_ticks_lock);
+    if (!phvp->tick_limits) {
+	seconds = prom_tick_seconds();
+	tick_limits = malloc(phvp->nbins * sizeof(long long));
+	for (i = 0; tick_limits && i < phvp->nbins; i++)
+	    tick_limits[i] = phvp->limits[i] / seconds;
+	phvp->tick_limits = tick_limits;
+    }
+    UNLOCK(hist_ticks_lock);
+}
+
+// observe a time difference in prom_ticks() units:
+// no floating point or lock unless storage is mapped
+// (or the TSC rate is still provisional)
 int
-prom_format_histogram(PROM_FILE *f, struct prom_var *pvp) {
-    struct prom_hist_var *phvp = (struct prom_hist_var *)pvp;
-    int state, i;
+prom_histogram_observe_ticks(struct prom_hist_var *phvp, long long ticks) {
+    int i;
 
     if (!phvp->bins)
 	prom_histogram_check(phvp);
+    if (!phvp->tick_limits && prom_tick_calibrated)
+	prom_histogram_ticks_check(phvp);
+
+    // mapped sums are seconds (ie; summed over processes)
+    if (phvp->sump != &phvp->sum || !phvp->tick_limits)
+	return prom_histogram_observe(phvp, ticks * prom_tick_seconds());
+
+    PROM_ATOMIC_INCREMENT(phvp->tick_sum, ticks);
+    PROM_ATOMIC_INCREMENT(phvp->bins[phvp->nbins], 1);
+
+    i = phvp->nbins;
+    while (--i >= 0 && ticks <= phvp->tick_limits[i])
+	PROM_ATOMIC_INCREMENT(phvp->bins[i], 1);
+    return 0;
+}
+
+// output labels of a LABEL var of a labeled histogram (if any)
+static void
+prom_histogram_labels(PROM_FILE *f, int *state, struct prom_var *parent,
+		      struct prom_hist_label_var *phlvp) {
+    if (!phlvp)
+	return;
+    if (parent->format == prom_format_nlabeled) {
+	const char *rendered =
+	    prom_nlabel_render((struct prom_nlabel_var *)phlvp);
+
+	if (rendered)
+	    prom_format_labels(f, state, rendered);
+    }
+    else
+	prom_format_label(f, state, ((struct prom_labeled_var *)parent)->label,
+			  "%s", phlvp->base.name);
+}
+
+// format (cumulative) BINS and SUM under family PARENT,
+// with labels of PHLVP (if not NULL)
+static int
+prom_histogram_format_bins(PROM_FILE *f, struct prom_var *parent,
+			   struct prom_hist_label_var *phlvp, int nbins,
+			   const double *limits, prom_value *bins, double sum) {
+    long long count;
+    int state, i;
 
     // XXX taking per-histogram lock would guarantee
     // self-consistent data!
-    // fetch count once? where???
-    for (i = 0; i < phvp->nbins; i++) {
+    for (i = 0; i < nbins; i++) {
+	prom_format_start(f, &state, parent);
+	PROM_PUTS("_bucket", f);
+	prom_histogram_labels(f, &state, parent, phlvp);
+	prom_format_label(f, &state, "le", "%.15g", limits[i]);
+	prom_format_value_pv(f, &state, PROM_READ(bins + i));
+    }
+    count = PROM_READ(bins + nbins);
+    prom_format_start(f, &state, parent);
+    PROM_PUTS("_bucket", f);
+    prom_histogram_labels(f, &state, parent, phlvp);
+    prom_format_label(f, &state, "le", "+Inf");
+    prom_format_value_pv(f, &state, count);
+
+    prom_format_start(f, &state, parent);
+    PROM_PUTS("_count", f);
+    prom_histogram_labels(f, &state, parent, phlvp);
+    prom_format_value_pv(f, &state, count);
+
+    prom_format_start(f, &state, parent);
+    PROM_PUTS("_sum", f);
+    prom_histogram_labels(f, &state, parent, phlvp);
+    prom_format_value_dbl(f, &state, sum);
+
+    return 0;				/* XXX */
+}
+
+int
+prom_format_histogram(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_hist_var *phvp = (struct prom_hist_var *)pvp;
+    long long ticks;
+    double sum;
+
+    if (!phvp->bins)
+	prom_histogram_check(phvp);
+
+    sum = PROM_READ_DBL(phvp->sump);
+    ticks = phvp->tick_sum;
+    if (ticks)
+	sum += ticks * prom_tick_seconds();
+    return prom_histogram_format_bins(f, pvp, NULL, phvp->nbins,
+				      phvp->limits, phvp->bins, sum);
+}
+
+////////////////
+// labeled histograms
+
+// allocate bins of all LABEL vars of a family, in one array,
+// in the order they're formatted
+void
+prom_histogram_label_check(struct prom_hist_label_var *phlvp) {
+    DECLARE_LOCK(hist_label_check_lock);
+    struct prom_hist_layout *layout = phlvp->layout;
+    struct prom_family *families, *pfp = NULL;
+    prom_value *bins;
+    double *sums;
+    int n, i;
+
+    LOCK(hist_label_check_lock);
+    if (layout->bins) {
+	UNLOCK(hist_label_check_lock);
+	return;
+    }
+    if (!layout->limits) {
+	layout->limits = default_bins;
+	layout->nbins = sizeof(default_bins)/sizeof(default_bins[0]);
+    }
+    n = prom_index(&families);
+    for (i = 0; i < n; i++)
+	if (families[i].pvp == phlvp->parent_var) {
+	    pfp = families + i;
+	    break;
+	}
+    if (!pfp) {				// can't happen?
+	UNLOCK(hist_label_check_lock);
+	return;
+    }
+    bins = calloc(pfp->nchildren * (layout->nbins + 1), sizeof(prom_value));
+    sums = calloc(pfp->nchildren, sizeof(double));
+    if (!bins || !sums) {
+	free(bins);
+	free(sums);
+	UNLOCK(hist_label_check_lock);
+	return;
+    }
+    for (i = 0; i < pfp->nchildren; i++) {
+	struct prom_hist_label_var *child =
+	    (struct prom_hist_label_var *)pfp->children[i];
+
+	child->bins = bins + i * (layout->nbins + 1);
+	child->sump = sums + i;
+    }
+    layout->nchildren = pfp->nchildren;
+    layout->sums = sums;
+    layout->bins = bins;
+    UNLOCK(hist_label_check_lock);
+}
+
+int
+prom_histogram_label_observe(struct prom_hist_label_var *phlvp,
+			     double value) {
+    // SHOULD be per-family lock! (but only used for single add)
+    DECLARE_LOCK(hist_label_observe_lock);
+    const struct prom_hist_layout *layout = phlvp->layout;
+    int i;
+
+    if (!phlvp->bins) {
+	prom_histogram_label_check(phlvp);
+	if (!phlvp->bins)
+	    return -1;
+    }
+
+    LOCK(hist_label_observe_lock);
+    *phlvp->sump += value;
+    UNLOCK(hist_label_observe_lock);
+
+    PROM_ATOMIC_INCREMENT(phlvp->bins[layout->nbins], 1);
+
+    i = layout->nbins;
+    while (--i >= 0 && value <= layout->limits[i])
+	PROM_ATOMIC_INCREMENT(phlvp->bins[i], 1);
+    return 0;
+}
+
+int
+prom_format_histogram_label(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_hist_label_var *phlvp = (struct prom_hist_label_var *)pvp;
+    const struct prom_hist_layout *layout = phlvp->layout;
+
+    if (!phlvp->bins) {
+	prom_histogram_label_check(phlvp);
+	if (!phlvp->bins)
+	    return -1;
+    }
+    return prom_histogram_format_bins(f, phlvp->parent_var, phlvp,
+				      layout->nbins, layout->limits,
+				      phlvp->bins, PROM_READ_DBL(phlvp->sump));
+}
+
+// bins are per-bucket: accumulate while formatting
+int
+prom_format_int_histogram(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_int_hist_var *pihvp = (struct prom_int_hist_var *)pvp;
+    int nbins = pihvp->max_pow - pihvp->min_pow + 1; // not including +Inf
+    long long count = 0;
+    int state, i;
+
+    for (i = 0; i < nbins; i++) {
+	count += PROM_READ(pihvp->bins + i);
 	prom_format_start(f, &state, pvp);
 	PROM_PUTS("_bucket", f);
-	prom_format_label(f, &state, "le", "%.15g", phvp->limits[i]);
-	prom_format_value_pv(f, &state, phvp->bins[i]);
+	prom_format_label(f, &state, "le", "%lld",
+			  1LL << (pihvp->min_pow + i));
+	prom_format_value_pv(f, &state, count);
     }
+    count += PROM_READ(pihvp->bins + nbins);
     prom_format_start(f, &state, pvp);
     PROM_PUTS("_bucket", f);
     prom_format_label(f, &state, "le", "+Inf");
-    prom_format_value_pv(f, &state, phvp->count);
+    prom_format_value_pv(f, &state, count);
 
     prom_format_start(f, &state, pvp);
     PROM_PUTS("_count", f);
-    prom_format_value_pv(f, &state, phvp->count);
+    prom_format_value_pv(f, &state, count);
 
     prom_format_start(f, &state, pvp);
     PROM_PUTS("_sum", f);
-    prom_format_value_dbl(f, &state, phvp->sum);
-
-    return 0;				/* XXX */
+    return prom_format_value_pv(f, &state, PROM_READ(&pihvp->sum));
 }
@@ -26,10 +26,12 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <stdlib.h>			/* atof */
 #include <string.h>
 #include <unistd.h>			/* write */
 
 #include "prom.h"
+#include "common.h"
 
 PROM_LABELED_COUNTER(promhttp_metric_handler_requests_total, "code",
 		  "Total number of scrapes by HTTP status code");
@@ -39,6 +41,11 @@ PROM_SIMPLE_COUNTER_LABEL(promhttp_metric_handler_requests_total,400); // bad re
 PROM_SIMPLE_COUNTER_LABEL(promhttp_metric_handler_requests_total,500); // internal error
 PROM_SIMPLE_COUNTER_LABEL(promhttp_metric_handler_requests_total,503); // service unavail
 
+PROM_GETTER_COUNTER_FN(promhttp_scrape_skipped_getters_total,
+		       "Getters skipped or served from cache to meet scrape deadline") {
+    return prom_deadline_skips;
+}
+
 // dodge to avoid complaints about unused result
 // (until the compilers get smarter)
 static int
@@ -61,12 +68,94 @@ prom_http_unavail(int fd)
 }
 #undef SEND
 
+////////////////
+// /metrics?name[]=NAME&prefix[]=PREFIX query handling
+
+#define MAX_FILTERS 32
+
+// fraction of Prometheus' scrape timeout to use
+// (leaving time for output to reach it)
+#define TIMEOUT_FRACTION 0.9
+
+static int
+hexval(int c) {
+    if (c >= '0' && c <= '9')
+	return c - '0';
+    if (c >= 'a' && c <= 'f')
+	return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+	return c - 'A' + 10;
+    return -1;
+}
+
+// decode %XX and '+' in place
+static void
+url_decode(char *s) {
+    char *d = s;
+
+    while (*s) {
+	if (*s == '%' && hexval(s[1]) >= 0 && hexval(s[2]) >= 0) {
+	    *d++ = hexval(s[1]) * 16 + hexval(s[2]);
+	    s += 3;
+	}
+	else if (*s == '+') {
+	    *d++ = ' ';
+	    s++;
+	}
+	else
+	    *d++ = *s++;
+    }
+    *d = '\0';
+}
+
+// parse query string (in place) into filters
+// unknown parameters are ignored
+// returns number of filters, or negative if too many
+static int
+parse_query(char *query, struct prom_filter *filters, int max) {
+    char *param, *next;
+    int n = 0;
+
+    for (param = query; param; param = next) {
+	char *value;
+	int prefix;
+
+	next = strchr(param, '&');
+	if (next)
+	    *next++ = '\0';
+	value = strchr(param, '=');
+	if (!value)
+	    continue;
+	*value++ = '\0';
+	url_decode(param);
+	url_decode(value);
+	if (!*value)
+	    continue;
+
+	if (strcmp(param, "name[]") == 0 || strcmp(param, "name") == 0)
+	    prefix = 0;
+	else if (strcmp(param, "prefix[]") == 0 || strcmp(param, "prefix") == 0)
+	    prefix = 1;
+	else
+	    continue;
+	if (n == max)
+	    return -1;
+	filters[n].name = value;
+	filters[n++].prefix = prefix;
+    }
+    return n;
+}
+
 int
 prom_http_request(PROM_FILE *in, PROM_FILE *out, const char *who) {
-    char line[128];
-    char cmd[128];
-    char path[128];
-    char proto[128];
+    char line[1024];
+    char cmd[1024];
+    char path[1024];
+    char proto[1024];
+    struct prom_filter filters[MAX_FILTERS];
+    int nfilters = 0;
+    char *query;
+    double timeout = 0;
 
     if (!PROM_GETS(line, sizeof(line), in)) {
 	// XXX count??
@@ -79,10 +168,18 @@ prom_http_request(PROM_FILE *in, PROM_FILE *out, const char *who) {
 	proto[0] = '\0';
 	/* FALLTHRU */
     case 3:
-	if (strcasecmp(cmd, "get") == 0)
-	    break;
-	/* FALLTHRU */
+	if (strcasecmp(cmd, "get") != 0)
+	    goto bad;
+	query = strchr(path, '?');
+	if (query) {
+	    *query++ = '\0';
+	    nfilters = parse_query(query, filters, MAX_FILTERS);
+	    if (nfilters < 0)
+		goto bad;
+	}
+	break;
     default:
+    bad:
 	// give an HTTP 1.0 response regardless; trying to keep it 99%
 	PROM_PRINTF(out, "HTTP/1.0 400 Bad Request\r\n\r\n");
 	PROM_SIMPLE_COUNTER_LABEL_INC(promhttp_metric_handler_requests_total,400);
@@ -90,9 +187,12 @@ prom_http_request(PROM_FILE *in, PROM_FILE *out, const char *who) {
     }
 
     if (proto[0]) {	    // eat headers if HTTP/1.0-like request
+	static const char timeout_hdr[] = "X-Prometheus-Scrape-Timeout-Seconds:";
+
 	while (PROM_GETS(line, sizeof(line), in) &&
 	       line[0] != '\r' && line[0] != '\n')
-	    ;
+	    if (strncasecmp(line, timeout_hdr, sizeof(timeout_hdr)-1) == 0)
+		timeout = atof(line + sizeof(timeout_hdr) - 1) * TIMEOUT_FRACTION;
 	PROM_PRINTF(out, "HTTP/1.0 200 OK\r\n"
 		    "Server: %s exporter (libprom)\r\n", who);
 	// XXX need Date: ?? I hope not!!!
@@ -105,7 +205,7 @@ prom_http_request(PROM_FILE *in, PROM_FILE *out, const char *who) {
 
 	// XXX if Content-Length: becomess necessary,
 	// handle by providing/requiring a prom_fmemopen function??
-	prom_format_vars(out);
+	prom_format_vars_timeout(out, filters, nfilters, timeout);
     }
     else {
 	if (proto[0])
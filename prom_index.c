@@ -0,0 +1,408 @@
+// registry index for libprom:
+// sorted table of families, each with its LABEL vars, built on first use
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>			/* calloc, qsort */
+#include <string.h>			/* strcmp, strlen */
+
+#include "prom.h"
+#include "common.h"
+
+#ifdef __APPLE__
+#include <mach-o/getsect.h>
+#ifdef __LP64__
+#define SECTION section_64
+#else
+#define SECTION section
+#endif // APPLE, not LP64
+
+#else // not __APPLE__
+
+#define CONC(X,Y) CONC2(X,Y)
+#define CONC2(X,Y) X##Y
+#define START_PROM_SECTION CONC(__start_,PROM_SECTION_NAME)
+#define STOP_PROM_SECTION CONC(__stop_,PROM_SECTION_NAME)
+
+extern struct prom_var START_PROM_SECTION[1], STOP_PROM_SECTION[1];
+#endif // not __APPLE__
+
+// locate the loader section holding all prom_vars
+// returns negative on failure
+int
+prom_section(struct prom_var **startp, struct prom_var **stopp) {
+#ifdef __APPLE__
+    static struct prom_var *start_prom_section, *stop_prom_section;
+
+    if (!start_prom_section) {
+	const struct SECTION *sect = getsectbyname(PROM_SEGMENT, PROM_SECTION_STR);
+	if (sect) {
+	    start_prom_section = (struct prom_var *) sect->addr;
+	    stop_prom_section  = (struct prom_var *) (sect->addr + sect->size);
+	}
+	else
+	    return -1;
+    }
+#define START_PROM_SECTION start_prom_section
+#define STOP_PROM_SECTION stop_prom_section
+#endif
+    *startp = START_PROM_SECTION;
+    *stopp = STOP_PROM_SECTION;
+    return 0;
+}
+
+////////////////
+
+// families sorted by name;
+// LABEL vars of each family sorted by label value(s), in one array
+static struct prom_family *prom_families;
+static int prom_nfamilies;
+
+// LABEL vars are formatted under their parent's name
+static struct prom_var *
+prom_parent(struct prom_var *pvp) {
+    return ((struct prom_label_var *)pvp)->parent_var;
+}
+
+static int
+prom_family_cmp(const void *a, const void *b) {
+    const struct prom_family *pa = a, *pb = b;
+
+    return strcmp(pa->pvp->name, pb->pvp->name);
+}
+
+// order LABEL vars by parent, then label value(s)
+static int
+prom_child_cmp(const void *a, const void *b) {
+    struct prom_var *pa = *(struct prom_var * const *)a;
+    struct prom_var *pb = *(struct prom_var * const *)b;
+    struct prom_var *parent = prom_parent(pa);
+
+    if (parent != prom_parent(pb))
+	return parent < prom_parent(pb) ? -1 : 1;
+    if (parent->format == prom_format_nlabeled) {
+	// by rendered labels: same order as saved in a prom_mmap file
+	const char *ra = prom_nlabel_render((struct prom_nlabel_var *)pa);
+	const char *rb = prom_nlabel_render((struct prom_nlabel_var *)pb);
+
+	if (ra && rb)
+	    return strcmp(ra, rb);
+    }
+    return strcmp(pa->name, pb->name);
+}
+
+static int
+prom_index_build(void) {
+    struct prom_var *start, *stop, *pvp, **children;
+    struct prom_family *families;
+    int nfamilies, nchildren, i, j;
+
+    if (prom_section(&start, &stop) < 0)
+	return -1;
+
+    nfamilies = nchildren = 0;
+    FOREACH_PROM_VAR(pvp, start, stop)
+	if (pvp->type == LABEL)
+	    nchildren++;
+	else
+	    nfamilies++;
+
+    families = calloc(nfamilies + 1, sizeof(*families));
+    children = calloc(nchildren + 1, sizeof(*children));
+    if (!families || !children) {
+	free(families);
+	free(children);
+	return -1;
+    }
+
+    nfamilies = nchildren = 0;
+    FOREACH_PROM_VAR(pvp, start, stop)
+	if (pvp->type == LABEL)
+	    children[nchildren++] = pvp;
+	else
+	    families[nfamilies++].pvp = pvp;
+
+    qsort(families, nfamilies, sizeof(*families), prom_family_cmp);
+    qsort(children, nchildren, sizeof(*children), prom_child_cmp);
+
+    // attach each run of LABEL vars to its family
+    for (i = 0; i < nchildren; i = j) {
+	struct prom_family key, *pfp;
+
+	for (j = i + 1;
+	     j < nchildren && prom_parent(children[j]) == prom_parent(children[i]);
+	     j++)
+	    ;
+	key.pvp = prom_parent(children[i]);
+	pfp = bsearch(&key, families, nfamilies, sizeof(*families),
+		      prom_family_cmp);
+	if (pfp) {
+	    pfp->children = children + i;
+	    pfp->nchildren = j - i;
+	}
+    }
+
+    prom_nfamilies = nfamilies;
+    __sync_synchronize();		// publish contents before pointer
+    prom_families = families;
+    return 0;
+}
+
+// build index (once)
+// returns number of families, or negative on failure
+int
+prom_index(struct prom_family **familiesp) {
+    DECLARE_LOCK(index_lock);
+    int ret = 0;
+
+    if (!prom_families) {
+	LOCK(index_lock);
+	if (!prom_families)
+	    ret = prom_index_build();
+	UNLOCK(index_lock);
+	if (ret < 0)
+	    return ret;
+    }
+    *familiesp = prom_families;
+    return prom_nfamilies;
+}
+
+// index of first family with name >= NAME
+// (comparing only first LEN chars if LEN > 0)
+static int
+prom_index_lower(const char *name, size_t len) {
+    int lo = 0, hi = prom_nfamilies;
+
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	const char *family = prom_families[mid].pvp->name;
+	int cmp = len ? strncmp(family, name, len) : strcmp(family, name);
+
+	if (cmp < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+// mark families matching one filter
+static void
+prom_index_mark(char *marks, const struct prom_filter *pfp) {
+    const char *name = pfp->name;
+    size_t nslen = strlen(prom_namespace);
+    size_t len = strlen(name);
+    int i;
+
+    // filter names are as exported: strip namespace
+    if (len <= nslen) {
+	// a prefix of the namespace matches everything
+	if (pfp->prefix && strncmp(prom_namespace, name, len) == 0)
+	    memset(marks, 1, prom_nfamilies);
+	return;
+    }
+    if (strncmp(name, prom_namespace, nslen) != 0)
+	return;
+    name += nslen;
+    len -= nslen;
+
+    if (!pfp->prefix)
+	len = 0;			// exact match
+    for (i = prom_index_lower(name, len); i < prom_nfamilies; i++) {
+	const char *family = prom_families[i].pvp->name;
+	if (len ? strncmp(family, name, len) : strcmp(family, name))
+	    break;
+	marks[i] = 1;
+    }
+}
+
+// mark family NAME (without namespace) as slow to format:
+// scrapes will format it in parallel if prom_eval_init was called
+// returns negative if not found
+int
+prom_mark_slow(const char *name) {
+    struct prom_family *families;
+    int n, i;
+
+    n = prom_index(&families);
+    if (n < 0)
+	return -1;
+    i = prom_index_lower(name, 0);
+    if (i == n || strcmp(families[i].pvp->name, name) != 0)
+	return -1;
+    families[i].slow = 1;
+    return 0;
+}
+
+// format a family: TYPE/HELP and value(s) of parent, then LABEL vars
+// (nothing for a sparse family with no samples)
+int
+prom_format_family(PROM_FILE *f, struct prom_family *pfp) {
+    int i;
+
+    if (pfp->nchildren && (pfp->pvp->flags & PROM_VAR_SPARSE)) {
+	prom_format_defer(pfp->pvp);	// until a LABEL var has a sample
+	(pfp->pvp->format)(f, pfp->pvp);
+	for (i = 0; i < pfp->nchildren; i++)
+	    prom_format_one(f, pfp->children[i]);
+	prom_format_defer(NULL);
+	return 0;
+    }
+    prom_format_one(f, pfp->pvp);	// XXX check return?
+    for (i = 0; i < pfp->nchildren; i++)
+	prom_format_one(f, pfp->children[i]);
+    return 0;
+}
+
+// exported by prom_http.c
+prom_value prom_deadline_skips;
+
+// count a family skipped (or served from cache) for lack of time
+void
+prom_deadline_skipped(void) {
+    PROM_ATOMIC_INCREMENT(prom_deadline_skips, 1);
+}
+
+// returns non-zero if DEADLINE (if any) has passed
+int
+prom_deadline_passed(const struct timespec *deadline) {
+    struct timespec now;
+
+    if (!deadline)
+	return 0;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (now.tv_sec > deadline->tv_sec ||
+	    (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec));
+}
+
+// non-zero if var can be formatted without calling user code
+// (as declared by the macro that defined it)
+static int
+prom_var_cheap(struct prom_var *pvp) {
+    if (pvp->flags & PROM_VAR_ASYNC)	// cached?
+	return prom_collector_interval && ((struct prom_async_var *)pvp)->stamp;
+    return pvp->flags & PROM_VAR_CHEAP;
+}
+
+// format family, unless DEADLINE has passed and
+// formatting it would call (possibly stalled) user code
+int
+prom_format_family_by(PROM_FILE *f, struct prom_family *pfp,
+		      const struct timespec *deadline) {
+    if (prom_deadline_passed(deadline)) {
+	int i, cheap = prom_var_cheap(pfp->pvp);
+
+	for (i = 0; cheap && i < pfp->nchildren; i++)
+	    cheap = prom_var_cheap(pfp->children[i]);
+	if (!cheap) {
+	    prom_deadline_skipped();
+	    return 0;
+	}
+    }
+    return prom_format_family(f, pfp);
+}
+
+// set by prom_eval_init
+int (*prom_eval_hook)(PROM_FILE *f, struct prom_family *families, int n,
+		      const char *marks, const struct timespec *deadline);
+
+// format families selected by MARKS (all if NULL), in name order
+static int
+prom_format_families(PROM_FILE *f, struct prom_family *families, int n,
+		     const char *marks, const struct timespec *deadline) {
+    int i;
+
+    time(&prom_now);
+    if (prom_scrape_hook)
+	(prom_scrape_hook)();
+    if (prom_eval_hook &&
+	(prom_eval_hook)(f, families, n, marks, deadline) == 0)
+	return 0;
+    for (i = 0; i < n; i++)
+	if (!marks || marks[i])
+	    prom_format_family_by(f, families + i, deadline);
+    return 0;
+}
+
+// format all families
+int
+prom_format_vars(PROM_FILE *f) {
+    struct prom_family *families;
+    int n;
+
+    n = prom_index(&families);
+    if (n < 0)
+	return -1;
+    return prom_format_families(f, families, n, NULL, NULL);
+}
+
+// format families matching FILTERS (all if NFILTERS is zero)
+// unmatched families are never touched (getters not called)
+// if TIMEOUT is non-zero, getters that would start after TIMEOUT seconds
+// are skipped, or served from cache
+int
+prom_format_vars_timeout(PROM_FILE *f, const struct prom_filter *filters,
+			 int nfilters, double timeout) {
+    struct prom_family *families;
+    struct timespec deadline, *dp = NULL;
+    char *marks = NULL;
+    int n, i, ret;
+
+    n = prom_index(&families);
+    if (n < 0)
+	return -1;
+
+    if (nfilters) {
+	marks = calloc(n + 1, 1);
+	if (!marks)
+	    return -1;
+	for (i = 0; i < nfilters; i++)
+	    prom_index_mark(marks, filters + i);
+    }
+
+    if (timeout > 0) {
+	long long ns;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	ns = deadline.tv_nsec + (long long)(timeout * 1e9);
+	deadline.tv_sec += ns / 1000000000;
+	deadline.tv_nsec = ns % 1000000000;
+	dp = &deadline;
+    }
+
+    ret = prom_format_families(f, families, n, marks, dp);
+    free(marks);
+    return ret;
+}
+
+// format only families matching FILTERS
+int
+prom_format_vars_filtered(PROM_FILE *f, const struct prom_filter *filters,
+			  int nfilters) {
+    if (nfilters == 0)			// match nothing
+	return 0;
+    return prom_format_vars_timeout(f, filters, nfilters, 0);
+}
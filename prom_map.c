@@ -0,0 +1,177 @@
+// relocate variable values into mapped memory
+// (shared between processes, or backed by a file)
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// "simple" values (including labels) and histogram bins live in
+// integer slots, histogram sums in double slots.  Slots are assigned
+// in index (name) order, so a given set of variables always maps the
+// same way.
+
+#include "prom.h"
+#include "common.h"
+
+static int claimed;
+
+// only one owner of mapped values (prom_shm_init or prom_mmap_init)
+// returns negative if already claimed
+int
+prom_map_claim(void) {
+    return __sync_bool_compare_and_swap(&claimed, 0, 1) ? 0 : -1;
+}
+
+// give up claim after failing to set up mapping
+void
+prom_map_release(void) {
+    __sync_lock_release(&claimed);
+}
+
+// describe storage of a var
+// returns zero if var has no mappable storage
+static int
+prom_map_describe(struct prom_var *pvp, struct prom_map_var *pmvp) {
+    pmvp->pvp = pvp;
+    pmvp->family = pvp;
+    if (pvp->type == LABEL)
+	pmvp->family = ((struct prom_label_var *)pvp)->parent_var;
+    pmvp->valpp = NULL;
+    pmvp->nint = 0;
+    pmvp->dblpp = NULL;
+    pmvp->ndbl = 0;
+
+    if (pvp->format == prom_format_simple) {
+	pmvp->valpp = &((struct prom_simple_var *)pvp)->valp;
+	pmvp->nint = 1;
+    }
+    else if (pvp->format == prom_format_simple_label) {
+	pmvp->valpp = &((struct prom_simple_label_var *)pvp)->valp;
+	pmvp->nint = 1;
+    }
+    else if (pvp->format == prom_format_simple_nlabel) {
+	pmvp->valpp = &((struct prom_simple_nlabel_var *)pvp)->valp;
+	pmvp->nint = 1;
+    }
+    else if (pvp->format == prom_format_histogram) {
+	struct prom_hist_var *phvp = (struct prom_hist_var *)pvp;
+
+	if (!phvp->bins)
+	    prom_histogram_check(phvp);
+	pmvp->valpp = &phvp->bins;
+	pmvp->nint = phvp->nbins + 1;
+	pmvp->dblpp = &phvp->sump;
+	pmvp->ndbl = 1;
+    }
+    else if (pvp->format == prom_format_histogram_label) {
+	struct prom_hist_label_var *phlvp = (struct prom_hist_label_var *)pvp;
+
+	if (!phlvp->bins)
+	    prom_histogram_label_check(phlvp);
+	if (phlvp->bins) {
+	    pmvp->valpp = &phlvp->bins;
+	    pmvp->nint = phlvp->layout->nbins + 1;
+	    pmvp->dblpp = &phlvp->sump;
+	    pmvp->ndbl = 1;
+	}
+    }
+    return pmvp->nint + pmvp->ndbl;
+}
+
+// call FN for each mappable var, in index order
+// sets *NINTP and *NDBLP to total slots of each kind
+// returns negative on failure (or if FN returns negative)
+int
+prom_map_walk(int (*fn)(struct prom_map_var *, void *), void *arg,
+	      int *nintp, int *ndblp) {
+    struct prom_family *families;
+    struct prom_map_var pmv;
+    int n, i, j, islot, dslot;
+
+    n = prom_index(&families);
+    if (n < 0)
+	return -1;
+
+    islot = dslot = 0;
+    for (i = 0; i < n; i++) {
+	struct prom_family *pfp = families + i;
+
+	for (j = -1; j < pfp->nchildren; j++) {
+	    if (!prom_map_describe(j < 0 ? pfp->pvp : pfp->children[j], &pmv))
+		continue;
+	    pmv.islot = islot;
+	    pmv.dslot = dslot;
+	    if (fn && (fn)(&pmv, arg) < 0)
+		return -1;
+	    islot += pmv.nint;
+	    dslot += pmv.ndbl;
+	}
+    }
+    if (nintp)
+	*nintp = islot;
+    if (ndblp)
+	*ndblp = dslot;
+    return 0;
+}
+
+struct prom_map_dest {
+    prom_value *ints;
+    double *dbls;
+    int copy;
+};
+
+static int
+prom_map_move(struct prom_map_var *pmvp, void *arg) {
+    struct prom_map_dest *pmdp = arg;
+    prom_value *ints = pmdp->ints + pmvp->islot;
+    int i;
+
+    if (pmdp->copy)
+	for (i = 0; i < pmvp->nint; i++)
+	    ints[i] = (long long)(*pmvp->valpp)[i];
+    *pmvp->valpp = ints;
+
+    if (pmvp->dblpp) {
+	double *dbls = pmdp->dbls + pmvp->dslot;
+
+	if (pmdp->copy)
+	    for (i = 0; i < pmvp->ndbl; i++)
+		dbls[i] = (*pmvp->dblpp)[i];
+	*pmvp->dblpp = dbls;
+    }
+    return 0;
+}
+
+// point all mappable vars at INTS/DBLS (sized by prom_map_walk),
+// copying current values if COPY is non-zero
+// NOTE! increments racing with this are lost: call before starting threads
+int
+prom_map_values(prom_value *ints, double *dbls, int copy) {
+    struct prom_map_dest pmd;
+
+    pmd.ints = ints;
+    pmd.dbls = dbls;
+    pmd.copy = copy;
+    return prom_map_walk(prom_map_move, &pmd, NULL, NULL);
+}
@@ -0,0 +1,443 @@
+// publish values in a memory mapped file, for reading by another process
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// prom_mmap_init writes a description of all simple vars and histograms
+// (see prom_mmap.h) to a file, maps it, and moves their values into it.
+// Another process (ie; promcat) can then map the file and render
+// current values without any cost (or threads) in this process.
+// Getters are NOT available in the file.
+//
+// prom_mmap_persist does the same, but first restores counter and
+// histogram values from the file left by a previous run, matching
+// entries by (namespace, name, labels), so values survive restarts.
+
+#include <sys/stat.h>
+
+#include <sys/types.h>
+#include <sys/file.h>			/* flock */
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>			/* snprintf, rename */
+#include <stdlib.h>			/* realloc */
+#include <string.h>
+#include <unistd.h>
+
+#include "prom.h"
+#include "common.h"
+#include "prom_mmap.h"
+
+#define ROUNDUP(X, N) (((X) + (N) - 1) / (N) * (N))
+
+// kept open (and flock'ed) for life of process (and children)
+// so prom_mmap_persist in another process can tell the file is in use
+static int map_fd = -1;
+
+struct mmap_build {
+    struct prom_mmap_ent *ents;
+    int nents, maxents;
+    char *strs;
+    size_t strslen, maxstrs;
+    double *lims;
+    int nlims, maxlims;
+    struct prom_var *family;		// last family seen
+    uint32_t name, help;		// its strings
+};
+
+// grow ARRAY (of COUNT, with room for MAX) to hold N more
+static int
+grow(void *arrayp, int *maxp, int count, int n, size_t size) {
+    void **ap = arrayp;
+    void *new;
+    int max;
+
+    if (count + n <= *maxp)
+	return 0;
+    max = (*maxp ? *maxp * 2 : 64) + n;
+    new = realloc(*ap, max * size);
+    if (!new)
+	return -1;
+    *ap = new;
+    *maxp = max;
+    return 0;
+}
+
+// returns string offset, or zero for empty string (or failure)
+static uint32_t
+add_str(struct mmap_build *bp, const char *str) {
+    size_t len, off;
+
+    if (!str || !*str)
+	return 0;
+    len = strlen(str) + 1;
+    if (bp->strslen == 0)
+	bp->strslen = 1;		// offset zero is empty string
+    if (bp->strslen + len > bp->maxstrs) {
+	size_t max = bp->maxstrs * 2 + len + 1024;
+	char *new = realloc(bp->strs, max);
+	if (!new)
+	    return 0;
+	bp->strs = new;
+	bp->maxstrs = max;
+	bp->strs[0] = '\0';
+    }
+    off = bp->strslen;
+    memcpy(bp->strs + off, str, len);
+    bp->strslen += len;
+    return off;
+}
+
+static int
+add_ent(struct prom_map_var *pmvp, void *arg) {
+    struct mmap_build *bp = arg;
+    struct prom_var *pvp = pmvp->pvp, *family = pmvp->family;
+    struct prom_mmap_ent *ep;
+
+    if (grow(&bp->ents, &bp->maxents, bp->nents, 1, sizeof(*ep)) < 0)
+	return -1;
+    ep = bp->ents + bp->nents++;
+    memset(ep, 0, sizeof(*ep));
+
+    if (family != bp->family) {
+	bp->family = family;
+	bp->name = add_str(bp, family->name);
+	bp->help = add_str(bp, family->help);
+    }
+    ep->name = bp->name;
+    ep->help = bp->help;
+    switch (family->type) {
+    case COUNTER: ep->type = PROM_MMAP_COUNTER; break;
+    case HISTOGRAM: ep->type = PROM_MMAP_HISTOGRAM; break;
+    default: ep->type = PROM_MMAP_GAUGE; break;
+    }
+
+    if (family->format == prom_format_labeled) {
+	char label[1024];
+
+	snprintf(label, sizeof(label), "%s=\"%s\"",
+		 ((struct prom_labeled_var *)family)->label, pvp->name);
+	ep->nlabels = 1;
+	ep->labels = add_str(bp, label);
+    }
+    else if (family->format == prom_format_nlabeled) {
+	ep->nlabels = ((struct prom_nlabeled_var *)family)->nlabels;
+	ep->labels = add_str(bp, prom_nlabel_render((struct prom_nlabel_var *)pvp));
+    }
+
+    if (pvp->format == prom_format_histogram ||
+	pvp->format == prom_format_histogram_label) {
+	int nbins;
+	const double *limits;
+
+	if (pvp->format == prom_format_histogram) {
+	    nbins = ((struct prom_hist_var *)pvp)->nbins;
+	    limits = ((struct prom_hist_var *)pvp)->limits;
+	}
+	else {
+	    nbins = ((struct prom_hist_label_var *)pvp)->layout->nbins;
+	    limits = ((struct prom_hist_label_var *)pvp)->layout->limits;
+	}
+	if (grow(&bp->lims, &bp->maxlims, bp->nlims, nbins,
+		 sizeof(double)) < 0)
+	    return -1;
+	ep->lims = bp->nlims;
+	memcpy(bp->lims + bp->nlims, limits, nbins * sizeof(double));
+	bp->nlims += nbins;
+    }
+
+    ep->islot = pmvp->islot;
+    ep->nint = pmvp->nint;
+    ep->dslot = pmvp->dslot;
+    ep->ndbl = pmvp->ndbl;
+    return 0;
+}
+
+static int
+write_all(int fd, const void *buf, size_t len, off_t off) {
+    return pwrite(fd, buf, len, off) == (ssize_t)len ? 0 : -1;
+}
+
+// write description of all mappable vars to new file PATH
+// (atomically replacing any existing file), map it, and lock it
+// returns mapping, or NULL on failure
+struct prom_mmap_hdr *
+prom_mmap_create(const char *path, size_t *sizep) {
+    struct mmap_build b;
+    struct prom_mmap_hdr hdr;
+    char tmp[1024];
+    size_t size;
+    int nint, ndbl, fd, ret;
+    void *base = NULL;
+
+    memset(&b, 0, sizeof(b));
+    memset(&hdr, 0, sizeof(hdr));
+    if (prom_map_walk(add_ent, &b, &nint, &ndbl) < 0)
+	goto out;
+    hdr.ns = add_str(&b, prom_namespace);
+    if (b.strslen == 0 && add_str(&b, "-") == 0) // want non-empty pool
+	goto out;
+
+    memcpy(hdr.magic, PROM_MMAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = PROM_MMAP_VERSION;
+    hdr.nents = b.nents;
+    hdr.nint = nint;
+    hdr.ndbl = ndbl;
+    hdr.pid = getpid();
+    hdr.ents_off = ROUNDUP(sizeof(hdr), 8);
+    hdr.strs_off = hdr.ents_off + b.nents * sizeof(*b.ents);
+    hdr.lims_off = ROUNDUP(hdr.strs_off + b.strslen, 8);
+    hdr.ints_off = ROUNDUP(hdr.lims_off + b.nlims * sizeof(double), 64);
+    hdr.dbls_off = hdr.ints_off + nint * sizeof(int64_t);
+    size = hdr.dbls_off + ndbl * sizeof(double);
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    fd = open(tmp, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (fd < 0)
+	goto out;
+    ret = flock(fd, LOCK_EX|LOCK_NB);	// new file: can't be held
+    if (ret == 0)
+	ret = ftruncate(fd, size);	// slots all zero
+    if (ret == 0)
+	ret = write_all(fd, &hdr, sizeof(hdr), 0);
+    if (ret == 0)
+	ret = write_all(fd, b.ents, b.nents * sizeof(*b.ents), hdr.ents_off);
+    if (ret == 0)
+	ret = write_all(fd, b.strs, b.strslen, hdr.strs_off);
+    if (ret == 0)
+	ret = write_all(fd, b.lims, b.nlims * sizeof(double), hdr.lims_off);
+    if (ret == 0) {
+	base = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+	    base = NULL;
+    }
+    if (base && rename(tmp, path) < 0) {
+	munmap(base, size);
+	base = NULL;
+    }
+    if (!base) {
+	close(fd);
+	unlink(tmp);
+    }
+    else {
+	if (map_fd >= 0)
+	    close(map_fd);
+	map_fd = fd;
+	*sizep = size;
+    }
+ out:
+    free(b.ents);
+    free(b.strs);
+    free(b.lims);
+    return base;
+}
+
+// publish values in memory mapped file PATH
+// call before starting threads
+// returns negative on failure
+int
+prom_mmap_init(const char *path) {
+    struct prom_mmap_hdr *hdr;
+    size_t size;
+
+    if (prom_map_claim() < 0)
+	return -1;
+    hdr = prom_mmap_create(path, &size);
+    if (!hdr) {
+	prom_map_release();
+	return -1;
+    }
+    return prom_map_values((prom_value *)((char *)hdr + hdr->ints_off),
+			   (double *)((char *)hdr + hdr->dbls_off), 1);
+}
+
+////////////////
+// persistence
+
+struct mmap_file {
+    const char *base;
+    const struct prom_mmap_hdr *hdr;
+    const struct prom_mmap_ent *ents;
+    const char *strs;
+    const double *lims;
+};
+
+#define FSTR(MFP, OFF) ((MFP)->strs + (OFF))
+
+static void
+mmap_file_setup(struct mmap_file *mfp, const void *base) {
+    mfp->base = base;
+    mfp->hdr = base;
+    mfp->ents = (const struct prom_mmap_ent *)(mfp->base + mfp->hdr->ents_off);
+    mfp->strs = mfp->base + mfp->hdr->strs_off;
+    mfp->lims = (const double *)(mfp->base + mfp->hdr->lims_off);
+}
+
+// take exclusive lock on FD, open on PATH
+// fails if held by another process, or PATH was replaced while waiting
+static int
+mmap_file_lock(const char *path, int fd) {
+    struct stat fst, pst;
+
+    if (flock(fd, LOCK_EX|LOCK_NB) < 0 ||
+	fstat(fd, &fst) < 0 || stat(path, &pst) < 0 ||
+	fst.st_dev != pst.st_dev || fst.st_ino != pst.st_ino)
+	return -1;
+    return 0;
+}
+
+// map an existing file read-only; returns size, or zero if unusable
+static size_t
+mmap_file_open(int fd, struct mmap_file *mfp) {
+    const struct prom_mmap_hdr *hdr;
+    struct stat st;
+    void *base;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr))
+	return 0;
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+	return 0;
+    hdr = base;
+    if (memcmp(hdr->magic, PROM_MMAP_MAGIC, sizeof(hdr->magic)) != 0 ||
+	hdr->version != PROM_MMAP_VERSION ||
+	hdr->dbls_off + hdr->ndbl * sizeof(double) > (uint64_t)st.st_size) {
+	munmap(base, st.st_size);
+	return 0;
+    }
+    mmap_file_setup(mfp, base);
+    return st.st_size;
+}
+
+// compare entries by name and labels (not types;
+// those are checked by ent_matches)
+static int
+ent_cmp(const struct mmap_file *afp, const struct prom_mmap_ent *ap,
+	const struct mmap_file *bfp, const struct prom_mmap_ent *bp) {
+    int ret;
+
+    ret = strcmp(FSTR(afp, ap->name), FSTR(bfp, bp->name));
+    if (ret == 0)
+	ret = strcmp(FSTR(afp, ap->labels), FSTR(bfp, bp->labels));
+    return ret;
+}
+
+// true if old entry OP can be restored into new entry NP
+static int
+ent_matches(const struct mmap_file *ofp, const struct prom_mmap_ent *op,
+	    const struct mmap_file *nfp, const struct prom_mmap_ent *np) {
+    if (op->type != np->type || op->nlabels != np->nlabels ||
+	op->nint != np->nint || op->ndbl != np->ndbl)
+	return 0;
+    if (np->type == PROM_MMAP_HISTOGRAM &&
+	memcmp(ofp->lims + op->lims, nfp->lims + np->lims,
+	       (np->nint - 1) * sizeof(double)) != 0)
+	return 0;			// bucket limits changed
+    return 1;
+}
+
+// add counter and histogram values from old file to new one
+// entries in both are in index order (by name, then label)
+static void
+mmap_restore(const struct mmap_file *ofp, struct mmap_file *nfp) {
+    const int64_t *oints = (const int64_t *)(ofp->base + ofp->hdr->ints_off);
+    const double *odbls = (const double *)(ofp->base + ofp->hdr->dbls_off);
+    prom_value *nints = (prom_value *)(nfp->base + nfp->hdr->ints_off);
+    double *ndbls = (double *)(nfp->base + nfp->hdr->dbls_off);
+    unsigned o, n, i;
+
+    if (strcmp(FSTR(ofp, ofp->hdr->ns), FSTR(nfp, nfp->hdr->ns)) != 0)
+	return;				// different namespace: all differ
+
+    for (o = n = 0; o < ofp->hdr->nents && n < nfp->hdr->nents; ) {
+	const struct prom_mmap_ent *op = ofp->ents + o;
+	const struct prom_mmap_ent *np = nfp->ents + n;
+	int cmp = ent_cmp(ofp, op, nfp, np);
+
+	if (cmp < 0)			// old only
+	    o++;
+	else if (cmp > 0)		// new only
+	    n++;
+	else {
+	    if (np->type != PROM_MMAP_GAUGE && ent_matches(ofp, op, nfp, np)) {
+		for (i = 0; i < np->nint; i++)
+		    nints[np->islot + i] += oints[op->islot + i];
+		for (i = 0; i < np->ndbl; i++)
+		    ndbls[np->dslot + i] += odbls[op->dslot + i];
+	    }
+	    o++;
+	    n++;
+	}
+    }
+}
+
+// like prom_mmap_init, but first restores counter and histogram values
+// saved in PATH by a previous run.  Gauges start from zero.
+// fails with EBUSY if PATH is in use by another running process
+// (checked with flock: the lock goes away when the owner exits).
+// returns negative on failure
+int
+prom_mmap_persist(const char *path) {
+    struct mmap_file old, new;
+    size_t oldsize, newsize;
+    struct prom_mmap_hdr *hdr;
+    int ret, fd;
+
+    memset(&old, 0, sizeof(old));
+    oldsize = 0;
+    fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd >= 0) {
+	// hold lock on old file until new one has replaced it
+	if (mmap_file_lock(path, fd) < 0) {
+	    close(fd);
+	    errno = EBUSY;
+	    return -1;
+	}
+	oldsize = mmap_file_open(fd, &old);
+    }
+
+    ret = -1;
+    if (prom_map_claim() < 0)
+	goto out;
+    hdr = prom_mmap_create(path, &newsize);
+    if (!hdr) {
+	prom_map_release();
+	goto out;
+    }
+    ret = prom_map_values((prom_value *)((char *)hdr + hdr->ints_off),
+			  (double *)((char *)hdr + hdr->dbls_off), 1);
+    if (ret == 0 && oldsize) {
+	mmap_file_setup(&new, hdr);
+	mmap_restore(&old, &new);
+    }
+ out:
+    if (oldsize)
+	munmap((void *)old.base, oldsize);
+    if (fd >= 0)
+	close(fd);
+    return ret;
+}
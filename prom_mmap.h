@@ -0,0 +1,70 @@
+// layout of libprom memory mapped metrics file
+// (written by prom_mmap_init, read by promcat)
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// File is: header, entry table, string pool, histogram limits,
+// then the live value slots (integer slots, then double slots).
+// Offsets are in bytes from start of file; string offsets are
+// relative to the string pool (zero is the empty string).
+// All values are in native byte order.
+
+#include <stdint.h>
+
+#define PROM_MMAP_MAGIC "PROMMAP"
+#define PROM_MMAP_VERSION 2
+
+struct prom_mmap_hdr {
+    char magic[8];			// PROM_MMAP_MAGIC
+    uint32_t version;			// PROM_MMAP_VERSION
+    uint32_t nents;
+    uint64_t ents_off;			// struct prom_mmap_ent[nents]
+    uint64_t strs_off;			// char[]
+    uint64_t lims_off;			// double[]
+    uint64_t ints_off;			// int64_t[nint]
+    uint64_t dbls_off;			// double[ndbl]
+    uint32_t nint, ndbl;
+    int64_t pid;			// writer
+    uint32_t ns;			// prom_namespace (string)
+    uint32_t pad;
+};
+
+// one per simple value, labeled simple value, or histogram
+// entries for a family are adjacent, in label order
+struct prom_mmap_ent {
+    uint32_t type;			// PROM_MMAP_{GAUGE,COUNTER,HISTOGRAM}
+    uint32_t nlabels;
+    uint32_t name, help;		// strings
+    uint32_t labels;			// name1="value1",... (string)
+    uint32_t islot, nint;		// integer slots (histogram: bins, +Inf)
+    uint32_t dslot, ndbl;		// double slots (histogram: sum)
+    uint32_t lims;			// histogram limits (index in lims)
+    uint32_t pad;
+};
+
+#define PROM_MMAP_GAUGE 0
+#define PROM_MMAP_COUNTER 1
+#define PROM_MMAP_HISTOGRAM 2
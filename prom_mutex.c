@@ -0,0 +1,181 @@
+// instrumented mutexes: contention (and hold time) histograms
+
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Waits are only timed when pthread_mutex_trylock fails, so an
+// uncontended PROM_MUTEX_LOCK costs about the same as
+// pthread_mutex_lock.  Times are kept in integer nanoseconds so
+// recording needs only atomic increments (no lock, and no use of
+// prom_histogram_observe, which the library's own locks would recurse on).
+
+#include <time.h>
+
+#include "prom.h"
+#include "common.h"
+
+#ifndef NO_THREADS
+
+// bucket limits, in ns and seconds
+static const long long limits_ns[PROM_MUTEX_NBINS] = {
+    1000, 4000, 16000, 64000, 256000,
+    1000000, 4000000, 16000000, 64000000, 256000000,
+    1000000000
+};
+
+static const double limits[PROM_MUTEX_NBINS] = {
+    .000001, .000004, .000016, .000064, .000256,
+    .001, .004, .016, .064, .256,
+    1
+};
+
+// sparse: no TYPE/HELP lines when no mutex (or none contended)
+struct prom_labeled_var prom_mutex_contended_family PROM_SECTION_ATTR =
+    { { sizeof(struct prom_labeled_var), COUNTER,
+	"prom_mutex_contended_total", "Times a mutex was found locked",
+	prom_format_labeled, PROM_VAR_CHEAP|PROM_VAR_SPARSE }, "mutex" };
+
+struct prom_labeled_var prom_mutex_wait_family PROM_SECTION_ATTR =
+    { { sizeof(struct prom_labeled_var), HISTOGRAM,
+	"prom_mutex_wait_seconds", "Time waited for a contended mutex",
+	prom_format_labeled, PROM_VAR_CHEAP|PROM_VAR_SPARSE }, "mutex" };
+
+struct prom_labeled_var prom_mutex_hold_family PROM_SECTION_ATTR =
+    { { sizeof(struct prom_labeled_var), HISTOGRAM,
+	"prom_mutex_hold_seconds", "Time a mutex was held",
+	prom_format_labeled, PROM_VAR_CHEAP|PROM_VAR_SPARSE }, "mutex" };
+
+static long long
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+observe(prom_value *bins, prom_value *sump, long long ns) {
+    int i;
+
+    for (i = 0; i < PROM_MUTEX_NBINS && ns > limits_ns[i]; i++)
+	;
+    PROM_ATOMIC_INCREMENT(bins[i], 1);
+    PROM_ATOMIC_INCREMENT(*sump, ns);
+}
+
+// trylock failed: time the wait
+int
+prom_mutex_lock_slow(struct prom_mutex *pmp) {
+    long long start = now_ns();
+    int ret = pthread_mutex_lock(&pmp->mutex);
+
+    if (ret == 0)
+	observe(pmp->wait_bins, &pmp->wait_ns, now_ns() - start);
+    return ret;
+}
+
+// PROM_MUTEX_HOLD: called with mutex held
+void
+prom_mutex_locked(struct prom_mutex *pmp) {
+    pmp->locked = now_ns();
+}
+
+void
+prom_mutex_unlocking(struct prom_mutex *pmp) {
+    observe(pmp->hold_bins, &pmp->hold_ns, now_ns() - pmp->locked);
+}
+
+////////////////
+
+static long long
+total(prom_value *bins) {
+    long long count = 0;
+    int i;
+
+    for (i = 0; i <= PROM_MUTEX_NBINS; i++)
+	count += bins[i];
+    return count;
+}
+
+int
+prom_format_mutex_contended(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_mutex_label_var *pmlvp = (struct prom_mutex_label_var *)pvp;
+    int state;
+
+    prom_format_start(f, &state, &pmlvp->parent_var->base);
+    prom_format_label(f, &state, "mutex", "%s", pvp->name);
+    return prom_format_value_pv(f, &state, total(pmlvp->pmp->wait_bins));
+}
+
+// output per-bucket counts as a (cumulative) histogram
+// (nothing until first observation: most mutexes are never contended)
+static int
+format_hist(PROM_FILE *f, struct prom_var *pvp, prom_value *bins,
+	    prom_value *sump) {
+    struct prom_mutex_label_var *pmlvp = (struct prom_mutex_label_var *)pvp;
+    struct prom_var *parent = &pmlvp->parent_var->base;
+    long long count = 0;
+    int state, i;
+
+    if (total(bins) == 0)
+	return 0;
+    for (i = 0; i <= PROM_MUTEX_NBINS; i++) {
+	count += bins[i];
+	prom_format_start(f, &state, parent);
+	PROM_PUTS("_bucket", f);
+	prom_format_label(f, &state, "mutex", "%s", pvp->name);
+	if (i < PROM_MUTEX_NBINS)
+	    prom_format_label(f, &state, "le", "%.15g", limits[i]);
+	else
+	    prom_format_label(f, &state, "le", "+Inf");
+	prom_format_value_pv(f, &state, count);
+    }
+
+    prom_format_start(f, &state, parent);
+    PROM_PUTS("_count", f);
+    prom_format_label(f, &state, "mutex", "%s", pvp->name);
+    prom_format_value_pv(f, &state, count);
+
+    prom_format_start(f, &state, parent);
+    PROM_PUTS("_sum", f);
+    prom_format_label(f, &state, "mutex", "%s", pvp->name);
+    return prom_format_value_dbl(f, &state, *sump * 1e-9);
+}
+
+int
+prom_format_mutex_wait(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_mutex *pmp = ((struct prom_mutex_label_var *)pvp)->pmp;
+
+    return format_hist(f, pvp, pmp->wait_bins, &pmp->wait_ns);
+}
+
+int
+prom_format_mutex_hold(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_mutex *pmp = ((struct prom_mutex_label_var *)pvp)->pmp;
+
+    return format_hist(f, pvp, pmp->hold_bins, &pmp->hold_ns);
+}
+#endif // NO_THREADS
@@ -0,0 +1,108 @@
+// core/helper functions for N label variables
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "prom.h"
+#include "common.h"
+
+// prom_var.format for a labeled var
+// no value of its own
+int
+prom_format_nlabeled(PROM_FILE *f, struct prom_var *pvp) {
+    (void) f;
+    (void) pvp;
+    return 0;
+}
+
+// render name1="value1",... from the parent's label names,
+// and the label's name (comma separated value tokens)
+// (once: cached in pnlvp->rendered); returns NULL on failure
+const char *
+prom_nlabel_render(struct prom_nlabel_var *pnlvp) {
+    DECLARE_LOCK(nlabel_render_lock);
+    struct prom_nlabeled_var *parent =
+	(struct prom_nlabeled_var *)pnlvp->parent_var;
+    const char *vp = pnlvp->base.name;
+    char *rendered, *cp;
+    size_t len, vlen;
+    int i;
+
+    if (pnlvp->rendered)
+	return pnlvp->rendered;
+    LOCK(nlabel_render_lock);
+    if (!pnlvp->rendered) {
+	// values, plus name="", for each label
+	len = strlen(vp) + 1;
+	for (i = 0; i < parent->nlabels; i++)
+	    len += strlen(parent->labels[i]) + 4;
+	rendered = cp = malloc(len);
+	for (i = 0; rendered && i < parent->nlabels; i++) {
+	    vp += strspn(vp, ", ");
+	    vlen = strcspn(vp, ", ");
+	    cp += sprintf(cp, "%s%s=\"%.*s\"", i ? "," : "",
+			  parent->labels[i], (int)vlen, vp);
+	    vp += vlen;
+	}
+	pnlvp->rendered = rendered;
+    }
+    UNLOCK(nlabel_render_lock);
+    return pnlvp->rendered;
+}
+
+static int
+prom_format_nlabel_value(PROM_FILE *f, struct prom_var *pvp,
+			 prom_value value) {
+    struct prom_nlabel_var *pnlvp = (struct prom_nlabel_var *)pvp;
+    const char *rendered = prom_nlabel_render(pnlvp);
+    int state;
+
+    if (!rendered)
+	return -1;
+    prom_format_start(f, &state, pnlvp->parent_var);
+    prom_format_labels(f, &state, rendered);
+    return prom_format_value_pv(f, &state, value);
+}
+
+// prom_var.format for a simple value label
+// returns negative on failure
+int
+prom_format_simple_nlabel(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_simple_nlabel_var *psnlv = (struct prom_simple_nlabel_var *)pvp;
+
+    return prom_format_nlabel_value(f, pvp, PROM_READ(psnlv->valp));
+}
+
+// prom_var.format for a getter value label
+// returns negative on failure
+int
+prom_format_getter_nlabel(PROM_FILE *f, struct prom_var *pvp) {
+    struct prom_getter_nlabel_var *pgnlv = (struct prom_getter_nlabel_var *)pvp;
+
+    return prom_format_nlabel_value(f, pvp, pgnlv->getter());
+}
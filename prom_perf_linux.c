@@ -0,0 +1,319 @@
+// perf_event counters for the whole process (Linux)
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Call prom_perf_init() to load (early in main, before starting
+// threads: counters are inherited only by threads created after the
+// events are opened).  Opens two event groups, one of software events
+// (always available) and one of hardware (PMU) events, and reads each
+// with a single read() of the group leader at most every
+// prom_process_cache_ms.  Hardware events that can't be opened (no
+// PMU, as in most VMs) or were never scheduled on a PMU produce no
+// output.  Hardware counts are scaled up if the PMU was multiplexed.
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include <linux/perf_event.h>
+
+#include <errno.h>
+#include <pthread.h>			/* pthread_atfork */
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prom.h"
+#include "common.h"
+
+enum { SW, HW, NGROUPS };
+
+enum {
+    TASK_CLOCK,				// software group leader
+    CONTEXT_SWITCHES,
+    CPU_MIGRATIONS,
+    PAGE_FAULTS,
+    CYCLES,				// hardware group leader
+    INSTRUCTIONS,
+    CACHE_MISSES,
+    NCOUNTERS
+};
+
+static struct perf_counter {
+    int group;
+    uint32_t type;
+    uint64_t config;
+    int fd;				// -1 if not open
+    int index;				// position in group read
+    int valid;				// value is good
+    double value;
+} counters[NCOUNTERS] = {
+#define SW_COUNTER(CONFIG) { SW, PERF_TYPE_SOFTWARE, CONFIG, -1, 0, 0, 0 }
+#define HW_COUNTER(CONFIG) { HW, PERF_TYPE_HARDWARE, CONFIG, -1, 0, 0, 0 }
+    SW_COUNTER(PERF_COUNT_SW_TASK_CLOCK),
+    SW_COUNTER(PERF_COUNT_SW_CONTEXT_SWITCHES),
+    SW_COUNTER(PERF_COUNT_SW_CPU_MIGRATIONS),
+    SW_COUNTER(PERF_COUNT_SW_PAGE_FAULTS),
+    HW_COUNTER(PERF_COUNT_HW_CPU_CYCLES),
+    HW_COUNTER(PERF_COUNT_HW_INSTRUCTIONS),
+    HW_COUNTER(PERF_COUNT_HW_CACHE_MISSES),
+};
+
+static const int leaders[NGROUPS] = { TASK_CLOCK, CYCLES };
+
+static int wanted;			// prom_perf_init called
+static long long last_read;
+
+DECLARE_LOCK(perf_lock);
+
+static long long
+now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+perf_event_open(struct perf_event_attr *attr, int group_fd) {
+    // this process (thread), any CPU
+    return syscall(SYS_perf_event_open, attr, 0, -1, group_fd,
+		   PERF_FLAG_FD_CLOEXEC);
+}
+
+// Open one counter; try the most useful settings first: inherited by
+// new threads (but not forked children), counting kernel time.
+// Older kernels reject inherit with PERF_FORMAT_GROUP, or don't know
+// inherit_thread (EINVAL), and perf_event_paranoid >= 2 forbids
+// counting in the kernel (EACCES) for unprivileged processes.
+// Members must match their leader, so the leader's settings are kept.
+static int
+open_counter(struct perf_counter *pcp, int group_fd,
+	     struct perf_event_attr *settings) {
+    static const struct {
+	unsigned inherit, inherit_thread, exclude_kernel;
+    } tries[] = {
+	{ 1, 1, 0 }, { 1, 1, 1 },
+	{ 1, 0, 0 }, { 1, 0, 1 },
+	{ 0, 0, 0 }, { 0, 0, 1 },
+    };
+    struct perf_event_attr attr;
+    unsigned i;
+
+    for (i = 0; i < sizeof(tries)/sizeof(tries[0]); i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = pcp->type;
+	attr.config = pcp->config;
+	attr.read_format = PERF_FORMAT_GROUP |
+	    PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_hv = 1;
+	if (group_fd >= 0) {		// member: same as leader
+	    attr.inherit = settings->inherit;
+	    attr.inherit_thread = settings->inherit_thread;
+	    attr.exclude_kernel = settings->exclude_kernel;
+	}
+	else {
+	    attr.disabled = 1;		// enabled with the whole group
+	    attr.inherit = tries[i].inherit;
+	    attr.inherit_thread = tries[i].inherit_thread;
+	    attr.exclude_kernel = tries[i].exclude_kernel;
+	}
+	pcp->fd = perf_event_open(&attr, group_fd);
+	if (pcp->fd >= 0) {
+	    if (group_fd < 0)
+		*settings = attr;
+	    return 0;
+	}
+	if (group_fd >= 0 || (errno != EINVAL && errno != EACCES &&
+			      errno != EPERM))
+	    break;			// (ie; ENOENT: no such event)
+    }
+    return -1;
+}
+
+// open both groups; call with perf_lock held
+static void
+open_groups(void) {
+    int g, i;
+
+    for (g = 0; g < NGROUPS; g++) {
+	struct perf_counter *leader = counters + leaders[g];
+	struct perf_event_attr settings;
+	int n = 0;
+
+	if (open_counter(leader, -1, &settings) < 0)
+	    continue;			// whole group unavailable
+	leader->index = n++;
+	for (i = 0; i < NCOUNTERS; i++) {
+	    struct perf_counter *pcp = counters + i;
+
+	    if (pcp->group != g || pcp == leader)
+		continue;
+	    if (open_counter(pcp, leader->fd, &settings) == 0)
+		pcp->index = n++;
+	}
+	ioctl(leader->fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+// read each group if stale; call with perf_lock held
+static void
+refresh(void) {
+    long long now = now_ms();
+    int g, i;
+
+    if (last_read && now - last_read < prom_process_cache_ms)
+	return;
+    last_read = now;
+
+    for (g = 0; g < NGROUPS; g++) {
+	struct {
+	    uint64_t nr, time_enabled, time_running;
+	    uint64_t values[NCOUNTERS];
+	} data;
+	int fd = counters[leaders[g]].fd;
+	double scale = 1;
+
+	memset(&data, 0, sizeof(data));
+	if (fd >= 0 && read(fd, &data, sizeof(data)) < 0)
+	    data.nr = 0;
+	// never counted (ie; PMU taken by the NMI watchdog): no output
+	if (data.time_running == 0)
+	    data.nr = 0;
+	else if (data.time_running < data.time_enabled) // multiplexed
+	    scale = (double)data.time_enabled / data.time_running;
+
+	for (i = 0; i < NCOUNTERS; i++) {
+	    struct perf_counter *pcp = counters + i;
+
+	    if (pcp->group != g)
+		continue;
+	    pcp->valid = pcp->fd >= 0 && (uint64_t)pcp->index < data.nr;
+	    if (pcp->valid)
+		pcp->value = data.values[pcp->index] * scale;
+	}
+    }
+}
+
+// output one counter (if available) times SCALE
+static int
+format_counter(PROM_FILE *f, struct prom_var *pvp, int counter,
+	       double scale) {
+    double value = 0;
+    int state, valid;
+
+    LOCK(perf_lock);
+    if (wanted)
+	refresh();
+    valid = counters[counter].valid;
+    value = counters[counter].value;
+    UNLOCK(perf_lock);
+    if (!valid)
+	return 0;
+    prom_format_start(f, &state, pvp);
+    return prom_format_value_dbl(f, &state, value * scale);
+}
+
+////////////////
+// software events
+
+PROM_FORMAT_COUNTER_FN(process_perf_task_clock_seconds_total,
+		       "CPU time counted by perf task-clock") {
+    return format_counter(f, pvp, TASK_CLOCK, 1e-9);
+}
+
+PROM_FORMAT_COUNTER_FN(process_perf_context_switches_total,
+		       "Context switches counted by perf") {
+    return format_counter(f, pvp, CONTEXT_SWITCHES, 1);
+}
+
+PROM_FORMAT_COUNTER_FN(process_perf_cpu_migrations_total,
+		       "Migrations between CPUs counted by perf") {
+    return format_counter(f, pvp, CPU_MIGRATIONS, 1);
+}
+
+PROM_FORMAT_COUNTER_FN(process_perf_page_faults_total,
+		       "Page faults counted by perf") {
+    return format_counter(f, pvp, PAGE_FAULTS, 1);
+}
+
+////////////////
+// hardware events (need a PMU)
+
+PROM_FORMAT_COUNTER_FN(process_perf_cpu_cycles_total,
+		       "CPU cycles counted by perf") {
+    return format_counter(f, pvp, CYCLES, 1);
+}
+
+PROM_FORMAT_COUNTER_FN(process_perf_instructions_total,
+		       "Instructions retired counted by perf") {
+    return format_counter(f, pvp, INSTRUCTIONS, 1);
+}
+
+PROM_FORMAT_COUNTER_FN(process_perf_cache_misses_total,
+		       "Last level cache misses counted by perf") {
+    return format_counter(f, pvp, CACHE_MISSES, 1);
+}
+
+////////////////
+
+// the events count the parent: close, and reopen now, while the
+// forking thread is the only thread (a later scrape would open them
+// from a server thread, counting only it, and threads it creates)
+static void
+perf_child(void) {
+    int i;
+
+    for (i = 0; i < NCOUNTERS; i++) {
+	if (counters[i].fd >= 0)
+	    close(counters[i].fd);
+	counters[i].fd = -1;
+	counters[i].valid = 0;
+    }
+    last_read = 0;
+    open_groups();
+}
+
+// call to load this file, and open the events
+// returns negative if even software events are unavailable
+// (ie; perf_event_paranoid is 3, or blocked by seccomp)
+int
+prom_perf_init(void) {
+    int ret;
+
+    LOCK(perf_lock);
+    if (!wanted) {
+	wanted = 1;
+	pthread_atfork(NULL, NULL, perf_child);
+	open_groups();
+    }
+    ret = counters[TASK_CLOCK].fd >= 0 ? 0 : -1;
+    UNLOCK(perf_lock);
+    return ret;
+}
@@ -14,29 +14,35 @@
 
 ////////////////
 // a gauge in all implementations I've looked at:
-PROM_SIMPLE_GAUGE(process_start_time_seconds,
-		  "Start time of the process in seconds since Unix epoch");
+// (a getter, so prom_shm_init doesn't sum it over processes)
+static time_t start_time;
 
 // run as a constructor:
 static void get_start_time(void) __attribute((constructor));
 
 static void
 get_start_time(void) {
-    // "SIMPLE" variables are integer-only
-    // so no point in calling gettimeofday()
-    PROM_SIMPLE_GAUGE_SET(process_start_time_seconds, time(0));
+    // integer-only, so no point in calling gettimeofday()
+    start_time = time(0);
+}
+
+PROM_GETTER_GAUGE_FN(process_start_time_seconds,
+		     "Start time of the process in seconds since Unix epoch") {
+    return start_time;
 }
 
 ////////////////
-PROM_GETTER_GAUGE_FN(process_open_fds,
-		     "Number of open file descriptors") {
+#ifndef FAST_OPEN_FDS
+// run by collector thread, if started; else cached for scrapes
+PROM_ASYNC_GETTER_GAUGE_FN(process_open_fds,
+			   "Number of open file descriptors") {
     DIR *d;
     static unsigned fds;
     DECLARE_LOCK(fds_lock);
     static time_t last_fds;
 
     LOCK(fds_lock);
-    if (STALE(last_fds) &&
+    if ((prom_collector_interval || STALE(last_fds)) &&
 	(d = opendir("/dev/fd"))) {
 	struct dirent *dp;
 
@@ -49,11 +55,13 @@ PROM_GETTER_GAUGE_FN(process_open_fds,
 #ifndef __FreeBSD__		// ?!
 	fds--;			// opendir fd
 #endif
+	last_fds = prom_now;
     }
     UNLOCK(fds_lock);
 
     return fds;
 }
+#endif
 
 ////////////////
 PROM_GETTER_GAUGE_FN(process_max_fds,
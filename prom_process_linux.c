@@ -33,10 +33,17 @@
 #include <sys/types.h>			/* pid_t */
 #include <sys/resource.h>		/* getrlimit */
 
-#include <string.h>			/* strncmp */
-#include <stdlib.h>			/* atol() */
-#include <time.h>			/* time(), time_t */
-#include <unistd.h>			/* getpid(), sysconf() */
+#include <sys/stat.h>			/* fstat */
+#include <sys/syscall.h>		/* SYS_getdents64 */
+
+#include <fcntl.h>			/* open */
+#include <pthread.h>			/* pthread_atfork */
+#include <stdint.h>
+#include <stdio.h>			/* open_memstream */
+#include <stdlib.h>			/* malloc */
+#include <string.h>			/* memchr, strncmp */
+#include <time.h>			/* clock_gettime */
+#include <unistd.h>			/* pread, sysconf() */
 
 #include "prom.h"
 #include "common.h"
@@ -49,16 +56,21 @@ static long pagesize;			/* bytes/page */
 static long tix;			/* ticks per second */
 #endif
 
-// data from /proc/PID/stat
+// reuse data read from /proc for this long
+int prom_process_cache_ms = 1000;
+// smaps_rollup costs scale with number of mappings: zero to disable
+int prom_smaps_cache_ms;
+
+// data from /proc/self/stat
 // from proc(5) man page
 
 // table defining macro, expanded multiple times
-// with different definitions of PROC_VAR & PROC_BUF
+// with different definitions of PROC_VAR, PROC_BUF & PROC_CHAR
 // this sort of thing was the norm in PDP-10 assembler.
 #define PROC_VARS \
     PROC_INT(pid) \
-    PROC_BUF(comm, 32, "(%[^)])") \
-    PROC_VAR(state, char, "%c") \
+    PROC_BUF(comm, 32) \
+    PROC_CHAR(state) \
     PROC_INT(ppid) \
     PROC_INT(pgrp) \
     PROC_INT(sess) \
@@ -77,92 +89,337 @@ static long tix;			/* ticks per second */
     PROC_LONG(nice) \
     PROC_LONG(threads) \
     PROC_LONG(itreal) \
-    PROC_VAR(start, long long, "%lld") \
+    PROC_VAR(start, long long) \
     PROC_ULONG(vsize) \
     PROC_LONG(rss)
 
 //  PROC_ULONG(rsslim)
 
 // shorthands
-#define PROC_INT(VAR) PROC_VAR(VAR, int, "%d")
-#define PROC_UINT(VAR) PROC_VAR(VAR, unsigned, "%u")
-#define PROC_LONG(VAR) PROC_VAR(VAR, long, "%ld")
-#define PROC_ULONG(VAR) PROC_VAR(VAR, unsigned long, "%lu")
+#define PROC_INT(VAR) PROC_VAR(VAR, int)
+#define PROC_UINT(VAR) PROC_VAR(VAR, unsigned)
+#define PROC_LONG(VAR) PROC_VAR(VAR, long)
+#define PROC_ULONG(VAR) PROC_VAR(VAR, unsigned long)
 
 // declare a static struct to hold data from /proc
 // (so it can be shared between getters)
 static struct {
-#define PROC_VAR(NAME, TYPE, FMT) TYPE NAME;
-#define PROC_BUF(NAME, SIZE, FMT) char NAME [SIZE];
+#define PROC_VAR(NAME, TYPE) TYPE NAME;
+#define PROC_BUF(NAME, SIZE) char NAME [SIZE];
+#define PROC_CHAR(NAME) char NAME;
     PROC_VARS
 #undef PROC_VAR
 #undef PROC_BUF
+#undef PROC_CHAR
 } proc_stat;
 
-static const char nvars[] = {
-#define PROC_VAR(NAME, TYPE, FMT) 1,
-#define PROC_BUF(NAME, SIZE, FMT) 1,
+// data from /proc/self/status and /proc/self/io
+static struct {
+    unsigned long long voluntary_ctxt_switches;
+    unsigned long long nonvoluntary_ctxt_switches;
+    unsigned long long vmhwm_kb;
+    unsigned long long vmswap_kb;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+} proc_status;
+
+////////////////
+// scanners: take pointer to next character and end of buffer,
+// return pointer after the field, or NULL
+// (also used by prom_threads_linux.c)
+
+static const char *
+skip_space(const char *cp, const char *end) {
+    while (cp < end && (*cp == ' ' || *cp == '\t'))
+	cp++;
+    return cp;
+}
+
+// (possibly negative) decimal number
+const char *
+prom_proc_scan_num(const char *cp, const char *end, unsigned long long *vp) {
+    unsigned long long v = 0;
+    int neg = 0;
+    const char *start;
+
+    cp = skip_space(cp, end);
+    if (cp < end && *cp == '-') {
+	neg = 1;
+	cp++;
+    }
+    for (start = cp; cp < end && *cp >= '0' && *cp <= '9'; cp++)
+	v = v * 10 + (*cp - '0');
+    if (cp == start)
+	return NULL;
+    *vp = neg ? -v : v;
+    return cp;
+}
+
+// "(comm)": comm may contain spaces and parens (it's set by the
+// process itself), so take everything up to the LAST close paren.
+const char *
+prom_proc_scan_comm(const char *cp, const char *end, char *buf, size_t size) {
+    const char *close;
+    size_t len;
+
+    cp = skip_space(cp, end);
+    if (cp >= end || *cp != '(')
+	return NULL;
+    cp++;
+    for (close = end - 1; close >= cp && *close != ')'; close--)
+	;
+    if (close < cp)
+	return NULL;
+    len = close - cp;
+    if (len >= size)
+	len = size - 1;
+    memcpy(buf, cp, len);
+    buf[len] = '\0';
+    return close + 1;
+}
+
+static int
+parse_stat(const char *buf, size_t len) {
+    const char *cp = buf, *end = buf + len;
+    unsigned long long v;
+
+#define PROC_VAR(NAME, TYPE) \
+    if (!(cp = prom_proc_scan_num(cp, end, &v))) \
+	return -1; \
+    proc_stat.NAME = (TYPE)v;
+#define PROC_BUF(NAME, SIZE) \
+    if (!(cp = prom_proc_scan_comm(cp, end, proc_stat.NAME, SIZE))) \
+	return -1;
+#define PROC_CHAR(NAME) \
+    cp = skip_space(cp, end); \
+    if (cp >= end) \
+	return -1; \
+    proc_stat.NAME = *cp++;
     PROC_VARS
 #undef PROC_VAR
 #undef PROC_BUF
+#undef PROC_CHAR
+    return 0;
+}
+
+// "Name:\tvalue[ kB]" lines
+static const struct proc_line {
+    const char *name;
+    unsigned long long *valp;
+} status_lines[] = {
+    { "VmHWM", &proc_status.vmhwm_kb },
+    { "VmSwap", &proc_status.vmswap_kb },
+    { "voluntary_ctxt_switches", &proc_status.voluntary_ctxt_switches },
+    { "nonvoluntary_ctxt_switches", &proc_status.nonvoluntary_ctxt_switches },
+    { NULL, NULL }
+}, io_lines[] = {
+    { "read_bytes", &proc_status.read_bytes },
+    { "write_bytes", &proc_status.write_bytes },
+    { NULL, NULL }
 };
-#define NUM_PROC_STAT sizeof(nvars)
 
-static time_t last_proc;
+static int
+parse_lines(const char *buf, size_t len, const struct proc_line *lines) {
+    const char *cp = buf, *end = buf + len;
+
+    while (cp < end) {
+	const char *colon, *eol = memchr(cp, '\n', end - cp);
+	const struct proc_line *lp;
+
+	if (!eol)
+	    eol = end;
+	colon = memchr(cp, ':', eol - cp);
+	if (colon)
+	    for (lp = lines; lp->name; lp++)
+		if (strncmp(lp->name, cp, colon - cp) == 0 &&
+		    lp->name[colon - cp] == '\0') {
+		    prom_proc_scan_num(colon + 1, eol, lp->valp);
+		    break;
+		}
+	cp = eol + 1;
+    }
+    return 0;
+}
+
+static int
+parse_status(const char *buf, size_t len) {
+    return parse_lines(buf, len, status_lines);
+}
 
 static int
-_read_proc(void) {
-    FILE *f;
-    unsigned n;
-    static char proc_stat_file[32];
+parse_io(const char *buf, size_t len) {
+    return parse_lines(buf, len, io_lines);
+}
 
-    if (!STALE(last_proc))
-	return 0;
+// data from /proc/self/smaps_rollup (kB), by label value
+// (Pss_* need Linux 5.8)
+#define SMAPS_LINES \
+    SMAPS_LINE(Rss, rss) \
+    SMAPS_LINE(Pss, pss) \
+    SMAPS_LINE(Pss_Anon, pss_anon) \
+    SMAPS_LINE(Pss_File, pss_file) \
+    SMAPS_LINE(Pss_Shmem, pss_shmem) \
+    SMAPS_LINE(Shared_Clean, shared_clean) \
+    SMAPS_LINE(Shared_Dirty, shared_dirty) \
+    SMAPS_LINE(Private_Clean, private_clean) \
+    SMAPS_LINE(Private_Dirty, private_dirty) \
+    SMAPS_LINE(Anonymous, anon) \
+    SMAPS_LINE(Swap, swap) \
+    SMAPS_LINE(SwapPss, swap_pss)
+
+static struct smaps_line {
+    const char *name, *label;
+    unsigned long long kb;
+    int found;
+} smaps_lines[] = {
+#define SMAPS_LINE(NAME, LABEL) { #NAME, #LABEL, 0, 0 },
+    SMAPS_LINES
+#undef SMAPS_LINE
+    { NULL, NULL, 0, 0 }
+};
 
-    if (!pagesize) {		/* once only */
-	snprintf(proc_stat_file, sizeof(proc_stat_file), "/proc/%d/stat", getpid());
-#ifndef USE_GETRUSAGE
-	tix = sysconf(_SC_CLK_TCK);
-#endif
-	pagesize = sysconf(_SC_PAGESIZE);
+static int
+parse_smaps(const char *buf, size_t len) {
+    const char *cp = buf, *end = buf + len;
+    struct smaps_line *lp;
+
+    for (lp = smaps_lines; lp->name; lp++)
+	lp->found = 0;
+    while (cp < end) {
+	const char *colon, *eol = memchr(cp, '\n', end - cp);
+
+	if (!eol)
+	    eol = end;
+	colon = memchr(cp, ':', eol - cp);
+	if (colon)
+	    for (lp = smaps_lines; lp->name; lp++)
+		if (strncmp(lp->name, cp, colon - cp) == 0 &&
+		    lp->name[colon - cp] == '\0') {
+		    lp->found = prom_proc_scan_num(colon + 1, eol, &lp->kb) != NULL;
+		    break;
+		}
+	cp = eol + 1;
     }
+    return 0;
+}
 
-    f = fopen(proc_stat_file, "r");
-    if (!f)
-	return -1;
+////////////////
+// /proc files are kept open, and reread with pread
+
+struct proc_file {
+    const char *path;
+    int (*parse)(const char *buf, size_t len);
+    int *cache_msp;			// how long to reuse data
+    int fd;				// -1 if not (yet) open
+    long long last;			// monotonic ms of last read
+};
 
-    // ORDINARILY fscanf is a mistake (win/lose)!
-    n = fscanf(f,
-#define PROC_VAR(NAME, TYPE, FMT) FMT " "
-#define PROC_BUF(NAME, SIZE, FMT) FMT " "
-	   PROC_VARS		// expand formats
-#undef PROC_VAR
-#undef PROC_BUF
-#define PROC_VAR(NAME, TYPE, FMT) ,&proc_stat.NAME
-#define PROC_BUF(NAME, SIZE, FMT) ,proc_stat.NAME
-	   PROC_VARS		// expand ptrs to vars
-#undef PROC_VAR
-#undef PROC_BUF
-	   );
-    fclose(f);
-    if (n < NUM_PROC_STAT)
-	return -1;		// will retry
+static struct proc_file stat_file = {
+    "/proc/self/stat", parse_stat, &prom_process_cache_ms, -1, 0 };
+static struct proc_file status_file = {
+    "/proc/self/status", parse_status, &prom_process_cache_ms, -1, 0 };
+static struct proc_file io_file = {
+    "/proc/self/io", parse_io, &prom_process_cache_ms, -1, 0 };
+static struct proc_file smaps_file = {
+    "/proc/self/smaps_rollup", parse_smaps, &prom_smaps_cache_ms, -1, 0 };
+
+static long long
+now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    last_proc = prom_now;
-    return 0;
+static int fd_dir = -1;			// /proc/self/fd (FAST_OPEN_FDS)
+static long long fds_last;
+
+// /proc/self was resolved at open: a child must reopen
+static void
+proc_child(void) {
+    struct proc_file *files[] = {
+	&stat_file, &status_file, &io_file, &smaps_file
+    };
+    unsigned i;
+
+    for (i = 0; i < sizeof(files)/sizeof(files[0]); i++) {
+	if (files[i]->fd >= 0)
+	    close(files[i]->fd);
+	files[i]->fd = -1;
+	files[i]->last = 0;
+    }
+    if (fd_dir >= 0)
+	close(fd_dir);
+    fd_dir = -1;
+    fds_last = 0;
+}
+
+static void
+proc_once(void) {
+    pthread_atfork(NULL, NULL, proc_child);
+#ifndef USE_GETRUSAGE
+    tix = sysconf(_SC_CLK_TCK);
+#endif
+    pagesize = sysconf(_SC_PAGESIZE);
+}
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+DECLARE_LOCK(read_proc_lock);		// also for parsed data in arrays
+
+// buffer for read_proc (shared, under read_proc_lock)
+static char *proc_buf;
+static size_t proc_bufsize;
+
+// read whole of FD into proc_buf, growing it as needed
+// (/proc/self/status is over 4KB on some kernels)
+// returns length, or negative on failure
+static ssize_t
+pread_all(int fd) {
+    for (;;) {
+	ssize_t len;
+	size_t size;
+	char *new;
+
+	if (proc_buf) {
+	    len = pread(fd, proc_buf, proc_bufsize, 0);
+	    if (len < (ssize_t)proc_bufsize) // short read: got it all
+		return len;
+	}
+	size = proc_bufsize ? proc_bufsize * 2 : 4096;
+	new = realloc(proc_buf, size);
+	if (!new)
+	    return -1;
+	proc_buf = new;
+	proc_bufsize = size;
+    }
 }
 
 static int
-read_proc(void) {
-    DECLARE_LOCK(read_proc_lock);
-    int ret;
+read_proc(struct proc_file *pfp) {
+    long long now = now_ms();
+    ssize_t len;
+    int ret = -1;
 
-    if (!STALE(last_proc))
+    if (pfp->last && now - pfp->last < *pfp->cache_msp)
 	return 0;
+    pthread_once(&once, proc_once);
+
     LOCK(read_proc_lock);
-    ret = _read_proc();
+    if (pfp->last && now - pfp->last < *pfp->cache_msp)
+	ret = 0;			// read while waiting for lock
+    else {
+	if (pfp->fd < 0)
+	    pfp->fd = open(pfp->path, O_RDONLY|O_CLOEXEC);
+	if (pfp->fd >= 0 &&
+	    (len = pread_all(pfp->fd)) > 0 &&
+	    (pfp->parse)(proc_buf, len) == 0) {
+	    pfp->last = now;
+	    ret = 0;
+	}
+    }
     UNLOCK(read_proc_lock);
-    return ret;
+    return ret;			// will retry
 }
 
 ////////////////////////////////////////////////////////////////
@@ -171,7 +428,7 @@ read_proc(void) {
 #ifndef USE_GETRUSAGE
 PROM_GETTER_COUNTER_FN(process_cpu_seconds_total,
 		       "Total user and system CPU time spent in seconds") {
-    if (read_proc() < 0)
+    if (read_proc(&stat_file) < 0)
 	return 0;
 
     // getrusage provides better granularity, but this is free
@@ -181,37 +438,326 @@ PROM_GETTER_COUNTER_FN(process_cpu_seconds_total,
 #endif
 
 ////////////////
-PROM_GETTER_GAUGE_FN(process_virtual_memory_bytes,
-		     "Virtual memory size in bytes") {
-    if (read_proc() < 0)
+PROM_ASYNC_GETTER_GAUGE_FN(process_virtual_memory_bytes,
+			   "Virtual memory size in bytes") {
+    if (read_proc(&stat_file) < 0)
 	return 0.0;
     return (double)proc_stat.vsize;
 }
 
 ////////////////
-PROM_GETTER_GAUGE_FN(process_resident_memory_bytes,
-		     "Resident memory size in bytes") {
-    if (read_proc() < 0)
+PROM_ASYNC_GETTER_GAUGE_FN(process_resident_memory_bytes,
+			   "Resident memory size in bytes") {
+    if (read_proc(&stat_file) < 0)
 	return 0.0;
     return ((double)proc_stat.rss) * pagesize;
 }
 
+////////////////
+PROM_ASYNC_GETTER_GAUGE_FN(process_resident_memory_peak_bytes,
+			   "Peak resident memory size in bytes") {
+    if (read_proc(&status_file) < 0)
+	return 0.0;
+    return proc_status.vmhwm_kb * 1024.0;
+}
+
+PROM_ASYNC_GETTER_GAUGE_FN(process_swap_bytes,
+			   "Swapped out memory size in bytes") {
+    if (read_proc(&status_file) < 0)
+	return 0.0;
+    return proc_status.vmswap_kb * 1024.0;
+}
+
+PROM_ASYNC_GETTER_COUNTER_FN(process_voluntary_context_switches_total,
+			     "Voluntary context switches") {
+    if (read_proc(&status_file) < 0)
+	return 0.0;
+    return proc_status.voluntary_ctxt_switches;
+}
+
+PROM_ASYNC_GETTER_COUNTER_FN(process_involuntary_context_switches_total,
+			     "Involuntary context switches") {
+    if (read_proc(&status_file) < 0)
+	return 0.0;
+    return proc_status.nonvoluntary_ctxt_switches;
+}
+
+////////////////
+// set prom_smaps_cache_ms to enable
+
+PROM_FORMAT_GAUGE_FN(process_memory_bytes,
+		     "Process memory by type, from smaps_rollup") {
+    struct smaps_line lines[sizeof(smaps_lines)/sizeof(smaps_lines[0])];
+    const struct smaps_line *lp;
+    int state;
+
+    if (prom_smaps_cache_ms <= 0 || read_proc(&smaps_file) < 0)
+	return 0;
+    // copy: another reader may reparse while formatting
+    LOCK(read_proc_lock);
+    memcpy(lines, smaps_lines, sizeof(lines));
+    UNLOCK(read_proc_lock);
+    for (lp = lines; lp->name; lp++) {
+	if (!lp->found)
+	    continue;
+	prom_format_start(f, &state, pvp);
+	prom_format_label(f, &state, "type", "%s", lp->label);
+	prom_format_value_pv(f, &state, lp->kb * 1024);
+    }
+    return 0;
+}
+
+////////////////
+// /proc/self/io needs CONFIG_TASK_IO_ACCOUNTING
+
+PROM_ASYNC_GETTER_COUNTER_FN(process_io_read_bytes_total,
+			     "Bytes read from storage") {
+    if (read_proc(&io_file) < 0)
+	return 0.0;
+    return proc_status.read_bytes;
+}
+
+PROM_ASYNC_GETTER_COUNTER_FN(process_io_write_bytes_total,
+			     "Bytes written to storage") {
+    if (read_proc(&io_file) < 0)
+	return 0.0;
+    return proc_status.write_bytes;
+}
+
+////////////////
+// replaces opendir/readdir version in prom_process.c
+#ifdef FAST_OPEN_FDS
+
+#define DENTS_SIZE (256*1024)
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static double
+count_fds(void) {
+    static char *dents;
+    struct stat st;
+    long len, off, n;
+
+    if (fd_dir < 0)
+	fd_dir = open("/proc/self/fd", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd_dir < 0)
+	return 0;
+
+    // Linux 6.2 and later: size is number of open fds (O(1))
+    if (fstat(fd_dir, &st) == 0 && st.st_size > 0)
+	return st.st_size - 1;		// not counting fd_dir
+
+    // count entries (without looking at names) using a big buffer
+    if (!dents && !(dents = malloc(DENTS_SIZE)))
+	return 0;
+    if (lseek(fd_dir, 0, SEEK_SET) < 0)
+	return 0;
+    n = 0;
+    while ((len = syscall(SYS_getdents64, fd_dir, dents, DENTS_SIZE)) > 0)
+	for (off = 0; off < len;
+	     off += ((struct linux_dirent64 *)(dents + off))->d_reclen)
+	    n++;
+    return n - 3;			// ".", ".." and fd_dir
+}
+
+PROM_ASYNC_GETTER_GAUGE_FN(process_open_fds,
+			   "Number of open file descriptors") {
+    DECLARE_LOCK(open_fds_lock);
+    static double fds;
+    long long now = now_ms();
+
+    pthread_once(&once, proc_once);
+    LOCK(open_fds_lock);
+    if (!fds_last || now - fds_last >= prom_process_cache_ms) {
+	fds = count_fds();
+	fds_last = now;
+    }
+    UNLOCK(open_fds_lock);
+    return fds;
+}
+#endif
+
 ////////////////
 // not even implemented by Java client library!!
+// mallinfo() is deprecated, overflows at 2GB, and was called inline.
+// Use the best source available (jemalloc or tcmalloc if linked,
+// else glibc mallinfo2, else malloc_info); values are shared by the
+// three (async) getters, and refreshed at most every
+// prom_process_cache_ms.  malloc_info formats XML for every arena
+// (taking each arena's lock), so is only preferred (for its arena
+// count) with HEAP_MALLOC_INFO.
 #ifdef PROCESS_HEAP
-#include <malloc.h>	      // mallinfo
+#include <malloc.h>			/* malloc_info, mallinfo2 */
+
+// present only if linked with jemalloc/tcmalloc (unprefixed)
+extern int mallctl(const char *name, void *oldp, size_t *oldlenp,
+		   void *newp, size_t newlen) __attribute__((weak));
+extern int MallocExtension_GetNumericProperty(const char *property,
+					      size_t *value)
+    __attribute__((weak));
+
+static struct {
+    double in_use, free, arenas;
+    long long last;
+} heap;
+
+static size_t
+jemalloc_stat(const char *name) {
+    size_t value = 0, len = sizeof(value);
+
+    mallctl(name, &value, &len, NULL, 0);
+    return value;
+}
+
+static int
+heap_jemalloc(void) {
+    uint64_t epoch = 1;
+    size_t len = sizeof(epoch);
+    unsigned narenas = 0;
+
+    mallctl("epoch", &epoch, &len, &epoch, len); // refresh stats
+    heap.in_use = jemalloc_stat("stats.allocated");
+    heap.free = (double)jemalloc_stat("stats.active") - heap.in_use;
+    len = sizeof(narenas);
+    mallctl("arenas.narenas", &narenas, &len, NULL, 0);
+    heap.arenas = narenas;
+    return 0;
+}
+
+static int
+heap_tcmalloc(void) {
+    size_t v = 0, unmapped = 0;
 
-PROM_GETTER_GAUGE_FN(process_heap_bytes,"Process heap size in bytes") {
-    struct mallinfo mi = mallinfo();
-    return (double)mi.uordblks;
+    if (!MallocExtension_GetNumericProperty("generic.current_allocated_bytes", &v))
+	return -1;
+    heap.in_use = v;
+    MallocExtension_GetNumericProperty("generic.heap_size", &v);
+    MallocExtension_GetNumericProperty("tcmalloc.pageheap_unmapped_bytes", &unmapped);
+    heap.free = (double)v - heap.in_use - unmapped;
+    heap.arenas = 1;			// page heap
+    return 0;
+}
+
+// value of SIZE attribute of first TAG after CP
+static double
+xml_size(const char *cp, const char *tag) {
+    unsigned long long v = 0;
+
+    cp = strstr(cp, tag);
+    if (!cp || !(cp = strstr(cp, "size=\"")))
+	return 0;
+    prom_proc_scan_num(cp + 6, cp + 32, &v);
+    return v;
+}
+
+static int
+heap_malloc_info(void) {
+    char *buf = NULL;
+    const char *cp, *totals;
+    size_t len = 0;
+    double current;
+    int arenas = 0;
+    FILE *f = open_memstream(&buf, &len);
+
+    if (!f)
+	return -1;
+    malloc_info(0, f);
+    fclose(f);
+    if (!buf)
+	return -1;
+
+    // totals follow the last per-arena <heap>
+    totals = buf;
+    for (cp = buf; (cp = strstr(cp, "<heap nr=")); cp++)
+	arenas++;
+    for (cp = buf; (cp = strstr(cp, "</heap>")); cp++)
+	totals = cp;
+    if (!arenas || !strstr(totals, "<system type=\"current\"")) {
+	free(buf);
+	return -1;
+    }
+    heap.free = xml_size(totals, "<total type=\"fast\"") +
+	xml_size(totals, "<total type=\"rest\"");
+    current = xml_size(totals, "<system type=\"current\"");
+    heap.in_use = current - heap.free + xml_size(totals, "<total type=\"mmap\"");
+    heap.arenas = arenas;
+    free(buf);
+    return 0;
+}
+
+static int
+heap_mallinfo2(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2();
+
+    heap.in_use = mi.uordblks + mi.hblkhd;
+    heap.free = mi.fordblks;
+    heap.arenas = -1;			// unknown: not output
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static void
+heap_refresh(void) {
+    DECLARE_LOCK(heap_lock);
+    long long now = now_ms();
+
+    LOCK(heap_lock);
+    if (!heap.last || now - heap.last >= prom_process_cache_ms) {
+	if (mallctl)
+	    heap_jemalloc();
+	else if (!MallocExtension_GetNumericProperty || heap_tcmalloc() < 0) {
+#ifdef HEAP_MALLOC_INFO
+	    if (heap_malloc_info() < 0)
+		heap_mallinfo2();
+#else
+	    if (heap_mallinfo2() < 0)
+		heap_malloc_info();
+#endif
+	}
+	heap.last = now;
+    }
+    UNLOCK(heap_lock);
+}
+
+PROM_ASYNC_GETTER_GAUGE_FN(process_heap_bytes,
+			   "Process heap in use in bytes") {
+    heap_refresh();
+    return heap.in_use;
+}
+
+PROM_ASYNC_GETTER_GAUGE_FN(process_heap_free_bytes,
+			   "Process heap free (held by allocator) in bytes") {
+    heap_refresh();
+    return heap.free;
+}
+
+// no sample (or TYPE/HELP) when the allocator doesn't say
+PROM_FORMAT_GAUGE_FN(process_heap_arenas, "Number of allocator arenas") {
+    int state;
+
+    heap_refresh();
+    if (heap.arenas < 0)
+	return 0;
+    prom_format_start(f, &state, pvp);
+    prom_format_value_dbl(f, &state, heap.arenas);
+    return 0;
 }
 #endif
 
 ////////////////
 // not in the process_ namespace
 
-PROM_GETTER_GAUGE_FN(num_threads, "Number of process threads") {
-    if (read_proc() < 0)
+PROM_ASYNC_GETTER_GAUGE_FN(num_threads, "Number of process threads") {
+    if (read_proc(&stat_file) < 0)
 	return 0.0;
     return proc_stat.threads;
 }
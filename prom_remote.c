@@ -0,0 +1,683 @@
+// push values using the Prometheus remote write protocol
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// For hosts that can't be scraped (ie; behind NAT): a thread takes a
+// snapshot of all samples every "interval" seconds, encodes them as
+// remote write (protobuf WriteRequest, snappy block compressed)
+// requests of up to BATCH_MAX series, and queues them (up to
+// QUEUE_MAX; oldest dropped).  Requests are POSTed over a persistent
+// HTTP/1.1 connection, with exponential backoff on failure.
+// Only http: URLs (no TLS).
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>			/* writev */
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>		/* TCP_NODELAY */
+
+#include <netdb.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>			/* strncasecmp */
+#include <time.h>
+#include <unistd.h>
+
+#include "prom.h"
+#include "common.h"
+
+#define BATCH_MAX 500			// series per request
+#define QUEUE_MAX 64			// requests waiting to be sent
+#define BACKOFF_MIN_MS 100
+#define BACKOFF_MAX_MS 30000
+#define IO_TIMEOUT 10			// seconds
+#define MAX_LABELS 32			// per series, including __name__
+
+PROM_SIMPLE_COUNTER(promremote_samples_total,
+		    "Samples sent by remote write");
+PROM_SIMPLE_COUNTER(promremote_failed_requests_total,
+		    "Remote write requests that failed (and were retried)");
+PROM_SIMPLE_COUNTER(promremote_dropped_requests_total,
+		    "Remote write requests dropped (queue full or rejected)");
+
+static char host[256], port[16], path[512];
+static int interval;			// zero if not running
+static int conn_fd = -1;
+
+// constant labels (ie; job, instance) added to every series
+static struct prom_sample_label extra[MAX_LABELS / 2];
+static int nextra;
+
+////////////////
+// growable buffer
+
+struct buf {
+    char *data;
+    size_t len, max;
+    int failed;
+};
+
+static int
+buf_room(struct buf *bp, size_t n) {
+    if (bp->len + n > bp->max) {
+	size_t max = bp->max * 2 + n + 4096;
+	char *data = realloc(bp->data, max);
+
+	if (!data) {
+	    bp->failed = 1;
+	    return 0;
+	}
+	bp->data = data;
+	bp->max = max;
+    }
+    return 1;
+}
+
+static void
+put_bytes(struct buf *bp, const void *p, size_t n) {
+    if (buf_room(bp, n)) {
+	memcpy(bp->data + bp->len, p, n);
+	bp->len += n;
+    }
+}
+
+static void
+put_byte(struct buf *bp, int c) {
+    if (buf_room(bp, 1))
+	bp->data[bp->len++] = c;
+}
+
+static void
+put_varint(struct buf *bp, uint64_t v) {
+    while (v >= 0x80) {
+	put_byte(bp, (v & 0x7f) | 0x80);
+	v >>= 7;
+    }
+    put_byte(bp, v);
+}
+
+static size_t
+varint_len(uint64_t v) {
+    size_t n = 1;
+
+    while (v >= 0x80) {
+	v >>= 7;
+	n++;
+    }
+    return n;
+}
+
+////////////////
+// snappy block format encoder
+// (see https://github.com/google/snappy/blob/main/format_description.txt)
+
+#define HASH_BITS 14
+
+static inline uint32_t
+load32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static void
+snappy_literal(struct buf *bp, const unsigned char *p, size_t n) {
+    size_t len = n - 1;
+
+    if (n == 0)
+	return;
+    if (len < 60)
+	put_byte(bp, len << 2);
+    else if (len < 0x100) {
+	put_byte(bp, 60 << 2);
+	put_byte(bp, len);
+    }
+    else if (len < 0x10000) {
+	put_byte(bp, 61 << 2);
+	put_byte(bp, len);
+	put_byte(bp, len >> 8);
+    }
+    else if (len < 0x1000000) {
+	put_byte(bp, 62 << 2);
+	put_byte(bp, len);
+	put_byte(bp, len >> 8);
+	put_byte(bp, len >> 16);
+    }
+    else {
+	put_byte(bp, 63 << 2);
+	put_byte(bp, len);
+	put_byte(bp, len >> 8);
+	put_byte(bp, len >> 16);
+	put_byte(bp, len >> 24);
+    }
+    put_bytes(bp, p, n);
+}
+
+// copy with 2-byte offset: 1..64 bytes
+static void
+snappy_copy(struct buf *bp, size_t offset, size_t len) {
+    while (len > 0) {
+	size_t n = len > 64 ? 64 : len;
+
+	put_byte(bp, 2 | ((n - 1) << 2));
+	put_byte(bp, offset);
+	put_byte(bp, offset >> 8);
+	len -= n;
+    }
+}
+
+static void
+snappy_encode(struct buf *bp, const unsigned char *in, size_t n) {
+    uint32_t table[1 << HASH_BITS];	// position + 1 (zero: empty)
+    size_t i, lit;
+
+    memset(table, 0, sizeof(table));
+    put_varint(bp, n);
+    lit = i = 0;
+    while (i + 4 <= n) {
+	uint32_t v = load32(in + i);
+	uint32_t h = (v * 0x1e35a7bdU) >> (32 - HASH_BITS);
+	size_t cand = table[h];
+
+	table[h] = i + 1;
+	if (cand-- && i - cand <= 0xffff && load32(in + cand) == v) {
+	    size_t len = 4;
+
+	    while (i + len < n && in[cand + len] == in[i + len])
+		len++;
+	    snappy_literal(bp, in + lit, i - lit);
+	    snappy_copy(bp, i - cand, len);
+	    i += len;
+	    lit = i;
+	}
+	else
+	    i++;
+    }
+    snappy_literal(bp, in + lit, n - lit);
+}
+
+////////////////
+// protobuf WriteRequest encoding
+//
+// message WriteRequest { repeated TimeSeries timeseries = 1; }
+// message TimeSeries { repeated Label labels = 1; repeated Sample samples = 2; }
+// message Label { string name = 1; string value = 2; }
+// message Sample { double value = 1; int64 timestamp = 2; }
+
+struct snapshot {
+    struct buf pb;			// WriteRequest being built
+    int nseries;
+    int64_t timestamp;			// ms since epoch
+};
+
+static size_t
+label_len(const struct prom_sample_label *lp) {
+    return 1 + varint_len(lp->namelen) + lp->namelen +
+	1 + varint_len(lp->valuelen) + lp->valuelen;
+}
+
+static int
+label_cmp(const struct prom_sample_label *a, const struct prom_sample_label *b) {
+    int n = a->namelen < b->namelen ? a->namelen : b->namelen;
+    int ret = memcmp(a->name, b->name, n);
+
+    return ret ? ret : a->namelen - b->namelen;
+}
+
+static void
+put_series(struct buf *bp, const struct prom_sample *psp, int64_t timestamp) {
+    struct prom_sample_label labels[MAX_LABELS], l;
+    const char *pos = psp->labels;
+    size_t len, slen;
+    uint64_t bits;
+    int n, i, j;
+
+    // __name__, constant labels and sample labels, sorted by name
+    labels[0].name = "__name__";
+    labels[0].namelen = 8;
+    labels[0].value = psp->name;
+    labels[0].valuelen = psp->namelen;
+    n = 1;
+    for (i = 0; i < nextra; i++)
+	labels[n++] = extra[i];
+    while (n < MAX_LABELS && pos && prom_sample_label(psp, &pos, &l))
+	labels[n++] = l;
+    for (i = 1; i < n; i++) {
+	l = labels[i];
+	for (j = i; j > 0 && label_cmp(labels + j - 1, &l) > 0; j--)
+	    labels[j] = labels[j - 1];
+	labels[j] = l;
+    }
+
+    slen = 1 + 8 + 1 + varint_len(timestamp);
+    len = 1 + varint_len(slen) + slen;
+    for (i = 0; i < n; i++) {
+	size_t llen = label_len(labels + i);
+	len += 1 + varint_len(llen) + llen;
+    }
+
+    put_byte(bp, 0x0a);			// WriteRequest.timeseries
+    put_varint(bp, len);
+    for (i = 0; i < n; i++) {
+	put_byte(bp, 0x0a);		// TimeSeries.labels
+	put_varint(bp, label_len(labels + i));
+	put_byte(bp, 0x0a);		// Label.name
+	put_varint(bp, labels[i].namelen);
+	put_bytes(bp, labels[i].name, labels[i].namelen);
+	put_byte(bp, 0x12);		// Label.value
+	put_varint(bp, labels[i].valuelen);
+	put_bytes(bp, labels[i].value, labels[i].valuelen);
+    }
+    put_byte(bp, 0x12);			// TimeSeries.samples
+    put_varint(bp, slen);
+    put_byte(bp, 0x09);			// Sample.value (fixed64)
+    bits = prom_dbl_to_bits(psp->value);
+    for (i = 0; i < 8; i++)
+	put_byte(bp, (bits >> (8 * i)) & 0xff);
+    put_byte(bp, 0x10);			// Sample.timestamp (varint)
+    put_varint(bp, timestamp);
+}
+
+////////////////
+// queue (only touched by the push thread)
+
+struct request {
+    char *data;				// snappy compressed WriteRequest
+    size_t len;
+    int nseries;
+};
+
+static struct request queue[QUEUE_MAX];
+static int qhead, qcount;
+
+static void
+queue_pop(void) {
+    free(queue[qhead].data);
+    queue[qhead].data = NULL;
+    qhead = (qhead + 1) % QUEUE_MAX;
+    qcount--;
+}
+
+// compress WriteRequest and add to queue
+static void
+queue_snapshot(struct snapshot *sp) {
+    struct buf out;
+    struct request *rp;
+
+    if (sp->nseries == 0 || sp->pb.failed)
+	goto reset;
+    memset(&out, 0, sizeof(out));
+    snappy_encode(&out, (unsigned char *)sp->pb.data, sp->pb.len);
+    if (out.failed) {
+	free(out.data);
+	goto reset;
+    }
+    if (qcount == QUEUE_MAX) {		// drop oldest
+	queue_pop();
+	PROM_SIMPLE_COUNTER_INC(promremote_dropped_requests_total);
+    }
+    rp = queue + (qhead + qcount++) % QUEUE_MAX;
+    rp->data = out.data;
+    rp->len = out.len;
+    rp->nseries = sp->nseries;
+ reset:
+    sp->pb.len = 0;
+    sp->pb.failed = 0;
+    sp->nseries = 0;
+}
+
+static int
+snapshot_sample(const struct prom_sample *psp, void *arg) {
+    struct snapshot *sp = arg;
+
+    put_series(&sp->pb, psp, sp->timestamp);
+    if (++sp->nseries == BATCH_MAX)
+	queue_snapshot(sp);
+    return 0;
+}
+
+static void
+snapshot(void) {
+    static struct snapshot snap;	// buffer reused
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    snap.timestamp = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    prom_sample_walk(snapshot_sample, &snap);
+    queue_snapshot(&snap);
+}
+
+////////////////
+// HTTP
+
+static void
+conn_close(void) {
+    if (conn_fd >= 0)
+	close(conn_fd);
+    conn_fd = -1;
+}
+
+static int
+conn_open(void) {
+    struct addrinfo hints, *res, *ai;
+    struct timeval tv = { IO_TIMEOUT, 0 };
+    int one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+	return -1;
+    for (ai = res; ai; ai = ai->ai_next) {
+	conn_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (conn_fd < 0)
+	    continue;
+	if (connect(conn_fd, ai->ai_addr, ai->ai_addrlen) == 0)
+	    break;
+	conn_close();
+    }
+    freeaddrinfo(res);
+    if (conn_fd < 0)
+	return -1;
+    setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(conn_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(conn_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return 0;
+}
+
+static int
+send_all(struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+	ssize_t n = writev(conn_fd, iov, iovcnt);
+
+	if (n <= 0)
+	    return -1;
+	while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+	    n -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + n;
+	    iov->iov_len -= n;
+	}
+    }
+    return 0;
+}
+
+// find header NAME in response headers (ending at END)
+static const char *
+find_header(const char *hdrs, const char *end, const char *name) {
+    size_t len = strlen(name);
+    const char *cp;
+
+    for (cp = hdrs; cp && cp + len < end; ) {
+	cp = memchr(cp, '\n', end - cp);
+	if (!cp)
+	    break;
+	cp++;
+	if (strncasecmp(cp, name, len) == 0 && cp[len] == ':')
+	    return cp + len + 1;
+    }
+    return NULL;
+}
+
+// true if header value at CP (ending at END) contains TOKEN
+static int
+header_has(const char *cp, const char *end, const char *token) {
+    const char *eol = memchr(cp, '\r', end - cp);
+    size_t len = strlen(token);
+
+    if (!eol)
+	eol = end;
+    for (; cp + len <= eol; cp++)
+	if (strncasecmp(cp, token, len) == 0)
+	    return 1;
+    return 0;
+}
+
+// read response, discarding body; returns HTTP status, or negative
+// closes the connection if the server asked, or if the body
+// length is unknown (ie; chunked), since the rest can't be skipped
+static int
+read_response(void) {
+    char resp[4096], scratch[4096];
+    const char *hdr_end, *cp;
+    size_t len = 0, body, clen = 0;
+    int status, keep;
+
+    for (;;) {
+	ssize_t n = read(conn_fd, resp + len, sizeof(resp) - 1 - len);
+
+	if (n <= 0)
+	    return -1;
+	len += n;
+	resp[len] = '\0';
+	hdr_end = strstr(resp, "\r\n\r\n");
+	if (hdr_end)
+	    break;
+	if (len == sizeof(resp) - 1)
+	    return -1;
+    }
+    hdr_end += 4;
+    if (sscanf(resp, "HTTP/%*d.%*d %d", &status) != 1)
+	return -1;
+    cp = find_header(resp, hdr_end, "Connection");
+    keep = !cp || !header_has(cp, hdr_end, "close");
+    if ((cp = find_header(resp, hdr_end, "Content-Length")))
+	clen = strtoul(cp, NULL, 10);
+    else if (status != 204 && status != 304)
+	keep = 0;			// no length: can't find end of body
+    if (!keep) {
+	conn_close();
+	return status;
+    }
+    body = len - (hdr_end - resp);
+    while (body < clen) {		// discard rest of body
+	size_t want = clen - body;
+	ssize_t n;
+
+	if (want > sizeof(scratch))
+	    want = sizeof(scratch);
+	n = read(conn_fd, scratch, want);
+	if (n <= 0)
+	    return -1;
+	body += n;
+    }
+    return status;
+}
+
+// POST a request; returns HTTP status, or negative
+static int
+post(const struct request *rp) {
+    char hdr[1024];
+    struct iovec iov[2];
+    int tries, hlen, status = -1;
+
+    hlen = snprintf(hdr, sizeof(hdr),
+		    "POST %s HTTP/1.1\r\n"
+		    "Host: %s:%s\r\n"
+		    "User-Agent: libprom\r\n"
+		    "Content-Type: application/x-protobuf\r\n"
+		    "Content-Encoding: snappy\r\n"
+		    "X-Prometheus-Remote-Write-Version: 0.1.0\r\n"
+		    "Content-Length: %zu\r\n"
+		    "\r\n", path, host, port, rp->len);
+
+    // a kept-alive connection may have been closed by the server:
+    // retry once on a new connection
+    for (tries = 0; tries < 2; tries++) {
+	int reused = conn_fd >= 0;
+
+	if (!reused && conn_open() < 0)
+	    return -1;
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = hlen;
+	iov[1].iov_base = rp->data;
+	iov[1].iov_len = rp->len;
+	if (send_all(iov, 2) == 0 && (status = read_response()) >= 0)
+	    return status;
+	conn_close();
+	if (!reused)
+	    break;
+    }
+    return -1;
+}
+
+////////////////
+
+static long long
+now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *
+prom_remote_thread(void *arg) {
+    long long next = now_ms(), retry_at = 0;
+    int backoff = 0;
+
+    (void) arg;
+    for (;;) {
+	long long now = now_ms(), wake;
+
+	if (now >= next) {
+	    snapshot();
+	    next += interval * 1000LL;
+	    if (next <= now)		// fell behind: skip
+		next = now + interval * 1000LL;
+	}
+	while (qcount > 0 && now >= retry_at) {
+	    struct request *rp = queue + qhead;
+	    int status = post(rp);
+
+	    if (status / 100 == 2) {
+		PROM_SIMPLE_COUNTER_INC_BY(promremote_samples_total,
+					   rp->nseries);
+		queue_pop();
+		backoff = 0;
+	    }
+	    else if (status >= 400 && status < 500 && status != 429) {
+		// rejected: retrying won't help
+		PROM_SIMPLE_COUNTER_INC(promremote_dropped_requests_total);
+		queue_pop();
+		backoff = 0;
+	    }
+	    else {
+		PROM_SIMPLE_COUNTER_INC(promremote_failed_requests_total);
+		backoff = backoff ? backoff * 2 : BACKOFF_MIN_MS;
+		if (backoff > BACKOFF_MAX_MS)
+		    backoff = BACKOFF_MAX_MS;
+		retry_at = now_ms() + backoff;
+		break;
+	    }
+	    now = now_ms();
+	}
+
+	wake = next;
+	if (qcount > 0 && retry_at < wake)
+	    wake = retry_at;
+	now = now_ms();
+	if (wake > now) {
+	    struct timespec ts;
+
+	    ts.tv_sec = (wake - now) / 1000;
+	    ts.tv_nsec = (wake - now) % 1000 * 1000000;
+	    nanosleep(&ts, NULL);
+	}
+    }
+    return NULL;
+}
+
+// thread doesn't survive fork
+static void
+prom_remote_child(void) {
+    interval = 0;
+    conn_fd = -1;			// parent's connection
+    while (qcount > 0)
+	queue_pop();
+}
+
+// add constant label NAME=VALUE to every series pushed
+// (call before prom_remote_write_init; strings are not copied)
+// returns negative on failure
+int
+prom_remote_write_label(const char *name, const char *value) {
+    struct prom_sample_label *lp;
+
+    if (interval || nextra == sizeof(extra)/sizeof(extra[0]))
+	return -1;
+    lp = extra + nextra++;
+    lp->name = name;
+    lp->namelen = strlen(name);
+    lp->value = value;
+    lp->valuelen = strlen(value);
+    return 0;
+}
+
+// push all samples to remote write URL ("http://host[:port]/path")
+// every INTERVAL seconds
+// returns negative on failure
+int
+prom_remote_write_init(const char *url, int secs) {
+    static int atfork;
+    const char *hp, *pp, *cp;
+    pthread_t t;
+    size_t hlen;
+
+    if (secs <= 0 || interval || strncmp(url, "http://", 7) != 0)
+	return -1;
+    hp = url + 7;
+    pp = strchr(hp, '/');
+    if (!pp)
+	pp = hp + strlen(hp);
+    cp = memchr(hp, ':', pp - hp);
+    hlen = (cp ? cp : pp) - hp;
+    if (hlen == 0 || hlen >= sizeof(host))
+	return -1;
+    memcpy(host, hp, hlen);
+    host[hlen] = '\0';
+    if (cp)
+	snprintf(port, sizeof(port), "%.*s", (int)(pp - cp - 1), cp + 1);
+    else
+	strcpy(port, "80");
+    snprintf(path, sizeof(path), "%s", *pp ? pp : "/");
+
+    if (!atfork++)
+	pthread_atfork(NULL, NULL, prom_remote_child);
+    interval = secs;
+    if (pthread_create(&t, NULL, prom_remote_thread, NULL) != 0) {
+	interval = 0;
+	return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
@@ -0,0 +1,149 @@
+// iterate over samples (for push outputs: remote write, statsd)
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Renders all vars in exposition format, and calls a function for
+// each sample line, so push outputs see exactly what a scrape would
+// (getters, labels, histogram buckets) without knowing var layouts.
+
+#include <stdio.h>			/* open_memstream */
+#include <stdlib.h>			/* free, strtod */
+#include <string.h>
+
+#include "prom.h"
+#include "common.h"
+
+// parse a sample line; returns zero if not a sample
+static int
+prom_sample_parse(struct prom_sample *psp, const char *line, const char *end) {
+    const char *cp = line;
+    char *vend;
+
+    psp->name = cp;
+    while (cp < end && *cp != '{' && *cp != ' ')
+	cp++;
+    psp->namelen = cp - psp->name;
+    psp->labels = NULL;
+    psp->labelslen = 0;
+    if (cp < end && *cp == '{') {
+	int quoted = 0;
+
+	psp->labels = ++cp;
+	while (cp < end && (quoted || *cp != '}')) {
+	    if (*cp == '\\' && quoted && cp + 1 < end)
+		cp++;
+	    else if (*cp == '"')
+		quoted = !quoted;
+	    cp++;
+	}
+	psp->labelslen = cp - psp->labels;
+	cp++;
+    }
+    if (cp >= end || *cp != ' ' || psp->namelen == 0)
+	return 0;
+    psp->value = strtod(cp + 1, &vend);
+    return vend != cp + 1;
+}
+
+// call FN for each sample, in output order
+// returns negative on failure (or if FN returns negative)
+int
+prom_sample_walk(int (*fn)(const struct prom_sample *, void *), void *arg) {
+    struct prom_sample s;
+    char *buf = NULL;
+    size_t len = 0;
+    const char *cp, *end;
+    FILE *f;
+    int ret = 0;
+
+    f = open_memstream(&buf, &len);
+    if (!f)
+	return -1;
+    prom_format_vars(f);
+    if (fclose(f) != 0) {
+	free(buf);
+	return -1;
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.type = -1;
+    for (cp = buf, end = buf + len; cp < end && ret >= 0; ) {
+	const char *eol = memchr(cp, '\n', end - cp);
+
+	if (!eol)
+	    eol = end;
+	if (eol - cp > 7 && memcmp(cp, "# TYPE ", 7) == 0) {
+	    const char *tp;
+
+	    s.family = cp + 7;
+	    tp = memchr(s.family, ' ', eol - s.family);
+	    if (!tp)
+		tp = eol;
+	    s.familylen = tp - s.family;
+	    s.type = -1;
+	    if (eol - tp == 6 && memcmp(tp, " gauge", 6) == 0)
+		s.type = GAUGE;
+	    else if (eol - tp == 8 && memcmp(tp, " counter", 8) == 0)
+		s.type = COUNTER;
+	    else if (eol - tp == 10 && memcmp(tp, " histogram", 10) == 0)
+		s.type = HISTOGRAM;
+	}
+	else if (cp < eol && *cp != '#' && prom_sample_parse(&s, cp, eol))
+	    ret = (fn)(&s, arg);
+	cp = eol + 1;
+    }
+    free(buf);
+    return ret < 0 ? -1 : 0;
+}
+
+// get next label from labels of a sample
+// *POSP starts at psp->labels; returns zero when no more
+int
+prom_sample_label(const struct prom_sample *psp, const char **posp,
+		  struct prom_sample_label *lp) {
+    const char *cp = *posp, *end = psp->labels + psp->labelslen;
+
+    while (cp < end && (*cp == ',' || *cp == ' '))
+	cp++;
+    if (cp >= end)
+	return 0;
+    lp->name = cp;
+    while (cp < end && *cp != '=')
+	cp++;
+    lp->namelen = cp - lp->name;
+    if (cp + 1 >= end || cp[1] != '"')
+	return 0;
+    cp += 2;
+    lp->value = cp;
+    while (cp < end && *cp != '"') {
+	if (*cp == '\\' && cp + 1 < end)
+	    cp++;			// XXX left escaped
+	cp++;
+    }
+    lp->valuelen = cp - lp->value;
+    *posp = cp + 1;
+    return 1;
+}
@@ -0,0 +1,333 @@
+// shared memory values for pre-forked multi-process servers
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// prom_shm_init (called before forking workers) moves the values of
+// all simple vars and histograms into an anonymous shared mapping,
+// with one block of slots per process.  Each child claims a (zeroed)
+// block of its own at fork time, so increments never contend between
+// processes.  Any process can serve scrapes: it sums all blocks into
+// a private copy, which formatters read in place of its own values.
+//
+// Blocks of processes that have exited are reclaimed: counter and
+// histogram values are first added to a "retired" block (so totals
+// never go backwards), gauge values are dropped.  Owners are recorded
+// with their start time (Linux), so a reused pid isn't taken as alive.
+//
+// NOTE! simple gauges are summed over all processes.
+
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>			/* kill */
+#include <stdio.h>			/* snprintf */
+#include <stdlib.h>			/* calloc */
+#include <string.h>			/* memset */
+#include <unistd.h>			/* getpid */
+
+#include "prom.h"
+#include "common.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define RETIRED 0			// block for exited processes
+
+#define ROUNDUP(X, N) (((X) + (N) - 1) / (N) * (N))
+
+struct prom_shm_owner {
+    pid_t pid;				// zero if free
+    long long start;			// start time, zero if unknown
+};
+
+struct prom_shm_hdr {
+    pthread_mutex_t lock;		// process shared
+    int nblocks;
+    struct prom_shm_owner owner[1];	// [nblocks]
+};
+
+static struct prom_shm_hdr *hdr;
+static char *blocks;			// nblocks * blocksize
+static size_t blocksize;
+static int nint, ndbl;			// slots per block
+static char *int_counter;		// [nint]: non-zero for counter slots
+
+// this process
+static int myblock;
+static long long *my_ints;
+static double *my_dbls;
+
+// sums, read by formatters
+static long long *agg_ints;
+static double *agg_dbls;
+static pthread_mutex_t agg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define BLOCK_INTS(N) ((long long *)(blocks + (N) * blocksize))
+#define BLOCK_DBLS(N) ((double *)(BLOCK_INTS(N) + nint))
+
+static int
+prom_shm_mark(struct prom_map_var *pmvp, void *arg) {
+    (void) arg;
+    if (pmvp->family->type != GAUGE)
+	memset(int_counter + pmvp->islot, 1, pmvp->nint);
+    return 0;
+}
+
+// add block N to sums
+// written so that the compiler can vectorize the loops
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("tree-vectorize")))
+#endif
+static void
+prom_shm_add(long long *restrict ints, double *restrict dbls, int n,
+	     const char *restrict mask) {
+    const long long *restrict bints = BLOCK_INTS(n);
+    const double *restrict bdbls = BLOCK_DBLS(n);
+    int i;
+
+    if (mask)
+	for (i = 0; i < nint; i++)
+	    ints[i] += mask[i] ? bints[i] : 0;
+    else
+	for (i = 0; i < nint; i++)
+	    ints[i] += bints[i];
+    for (i = 0; i < ndbl; i++)		// all histogram sums
+	dbls[i] += bdbls[i];
+}
+
+// start time of process PID (clock ticks since boot), or zero
+static long long
+prom_shm_start(pid_t pid) {
+#ifdef __linux__
+    char path[64], buf[1024];
+    const char *cp, *end;
+    ssize_t len;
+    int fd, field;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+	return 0;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+	return 0;
+    buf[len] = '\0';
+    end = buf + len;
+    cp = strrchr(buf, ')');		// comm may contain spaces
+    // field 3 (state) follows; starttime is field 22
+    for (field = 2; cp && cp < end && field < 22; field++)
+	cp = strchr(cp + 1, ' ');
+    return cp ? strtoll(cp + 1, NULL, 10) : 0;
+#else
+    (void) pid;
+    return 0;
+#endif
+}
+
+static int
+prom_shm_dead(const struct prom_shm_owner *op) {
+    if (op->pid == 0)
+	return 0;
+    if (kill(op->pid, 0) < 0)
+	return errno == ESRCH;
+    return op->start && prom_shm_start(op->pid) != op->start; // pid reused
+}
+
+// fold counters of exited process into RETIRED block, and free block
+// call with hdr->lock held
+static void
+prom_shm_retire(int n) {
+    prom_shm_add(BLOCK_INTS(RETIRED), BLOCK_DBLS(RETIRED), n, int_counter);
+    memset(BLOCK_INTS(n), 0, blocksize);
+    hdr->owner[n].pid = 0;
+}
+
+// claim a zeroed block for this process
+// returns block number, or negative if none available
+static int
+prom_shm_claim(void) {
+    pid_t pid = getpid();
+    long long start = prom_shm_start(pid);
+    int n, ret = -1;
+
+    pthread_mutex_lock(&hdr->lock);
+    for (n = RETIRED + 1; n < hdr->nblocks; n++) {
+	if (prom_shm_dead(hdr->owner + n))
+	    prom_shm_retire(n);
+	if (hdr->owner[n].pid == 0) {
+	    hdr->owner[n].pid = pid;
+	    hdr->owner[n].start = start;
+	    ret = n;
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&hdr->lock);
+    return ret;
+}
+
+// prom_scrape_hook: sum all blocks
+static void
+prom_shm_scrape(void) {
+    long long *ints;
+    double *dbls;
+    int n;
+
+    ints = calloc(nint + 1, sizeof(*ints));
+    dbls = calloc(ndbl + 1, sizeof(*dbls));
+    if (!ints || !dbls) {
+	free(ints);
+	free(dbls);
+	return;				// XXX stale sums
+    }
+
+    pthread_mutex_lock(&hdr->lock);
+    for (n = RETIRED + 1; n < hdr->nblocks; n++)
+	if (prom_shm_dead(hdr->owner + n))
+	    prom_shm_retire(n);
+    for (n = RETIRED; n < hdr->nblocks; n++)
+	if (n == RETIRED || hdr->owner[n].pid)
+	    prom_shm_add(ints, dbls, n, NULL);
+    pthread_mutex_unlock(&hdr->lock);
+
+    // publish: each slot is a complete sum, even if
+    // a concurrent scrape sees some slots updated
+    pthread_mutex_lock(&agg_lock);
+    memcpy(agg_ints, ints, nint * sizeof(*ints));
+    memcpy(agg_dbls, dbls, ndbl * sizeof(*dbls));
+    pthread_mutex_unlock(&agg_lock);
+    free(ints);
+    free(dbls);
+}
+
+// prom_read_hook: return sum in place of own value
+static long long
+prom_shm_read(prom_value *valp) {
+    long long *lp = (long long *)valp;
+
+    if (lp >= my_ints && lp < my_ints + nint)
+	return agg_ints[lp - my_ints];
+    return *lp;
+}
+
+static double
+prom_shm_read_dbl(double *dblp) {
+    if (dblp >= my_dbls && dblp < my_dbls + ndbl)
+	return agg_dbls[dblp - my_dbls];
+    return *dblp;
+}
+
+// move this process' values to block N
+static void
+prom_shm_use(int n, int copy) {
+    myblock = n;
+    my_ints = BLOCK_INTS(n);
+    my_dbls = BLOCK_DBLS(n);
+    prom_map_values((prom_value *)my_ints, my_dbls, copy);
+}
+
+// in a new child: start counting from zero in a block of its own
+static void
+prom_shm_child(void) {
+    int n;
+
+    pthread_mutex_init(&agg_lock, NULL);
+    n = prom_shm_claim();
+    if (n > 0)
+	prom_shm_use(n, 0);
+    // else: out of blocks; increments go to parent's block
+    // (totals still correct, but histogram sums may lose updates)
+}
+
+// create shared values for up to NPROCS processes
+// call before forking (and before starting threads)
+// returns negative on failure
+int
+prom_shm_init(int nprocs) {
+    pthread_mutexattr_t attr;
+    size_t hdrsize, size;
+    char *base = MAP_FAILED;
+    int n;
+
+    if (nprocs < 1 || prom_map_claim() < 0)
+	return -1;
+
+    if (prom_map_walk(NULL, NULL, &nint, &ndbl) < 0)
+	goto fail;
+    int_counter = calloc(nint + 1, 1);
+    agg_ints = calloc(nint + 1, sizeof(*agg_ints));
+    agg_dbls = calloc(ndbl + 1, sizeof(*agg_dbls));
+    if (!int_counter || !agg_ints || !agg_dbls)
+	goto fail;
+    prom_map_walk(prom_shm_mark, NULL, NULL, NULL);
+
+    hdrsize = ROUNDUP(sizeof(*hdr) + nprocs * sizeof(hdr->owner[0]), 64);
+    blocksize = ROUNDUP((nint + ndbl) * sizeof(long long), 64);
+    size = hdrsize + (nprocs + 1) * blocksize;
+    base = mmap(NULL, size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+	goto fail;
+
+    hdr = (struct prom_shm_hdr *)base;
+    blocks = base + hdrsize;
+    hdr->nblocks = nprocs + 1;		// plus RETIRED
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&hdr->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    n = prom_shm_claim();
+    if (n < 0)
+	goto fail;
+    prom_shm_use(n, 1);
+
+    prom_read_hook = prom_shm_read;
+    prom_read_dbl_hook = prom_shm_read_dbl;
+    prom_scrape_hook = prom_shm_scrape;
+    pthread_atfork(NULL, NULL, prom_shm_child);
+    return 0;
+
+ fail:
+    if (base != MAP_FAILED) {
+	pthread_mutex_destroy(&hdr->lock);
+	munmap(base, size);
+    }
+    hdr = NULL;
+    blocks = NULL;
+    free(int_counter);
+    free(agg_ints);
+    free(agg_dbls);
+    int_counter = NULL;
+    agg_ints = NULL;
+    agg_dbls = NULL;
+    prom_map_release();
+    return -1;
+}
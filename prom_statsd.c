@@ -0,0 +1,363 @@
+// send values to a StatsD (or DogStatsD) server
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// prom_statsd_flush walks the same samples a scrape would see and
+// sends gauges as-is, and counters (and histogram buckets, counts
+// and sums) as deltas since the last flush, packing as many lines as
+// fit into each datagram.  Labels are sent as DogStatsD tags, or
+// (plain StatsD) appended to the name: NAME.VALUE1.VALUE2
+
+#ifdef HAVE_SENDMMSG
+#define _GNU_SOURCE			/* sendmmsg */
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prom.h"
+#include "common.h"
+
+#define PACKET_SIZE 1432		// fits in 1500 byte MTU
+#define MAX_PACKETS 32			// per sendmmsg call
+#define LINE_MAX_LEN 512
+
+PROM_SIMPLE_COUNTER(promstatsd_packets_total, "StatsD datagrams sent");
+PROM_SIMPLE_COUNTER(promstatsd_send_errors_total,
+		    "StatsD datagrams that could not be sent");
+
+static int sock = -1;
+static int flags;
+static int interval;			// zero if no thread running
+
+static char packets[MAX_PACKETS][PACKET_SIZE];
+static size_t lens[MAX_PACKETS];
+static int npackets;
+
+////////////////
+// last counter values, by sample (name and labels)
+
+struct last {
+    char *key;
+    double value;
+};
+
+static struct last *table;
+static size_t tsize, tcount;		// tsize is a power of two
+
+static size_t
+key_hash(const char *key, size_t len) {
+    size_t h = 5381;
+
+    while (len-- > 0)
+	h = h * 33 + (unsigned char)*key++;
+    return h;
+}
+
+// returns entry for KEY (creating it with value zero), or NULL
+static struct last *
+last_lookup(const char *key, size_t len) {
+    struct last *lp;
+    size_t i;
+
+    if (tcount * 2 >= tsize) {		// grow and rehash
+	size_t nsize = tsize ? tsize * 2 : 256;
+	struct last *ntable = calloc(nsize, sizeof(*ntable));
+
+	if (!ntable)
+	    return NULL;
+	for (i = 0; i < tsize; i++) {
+	    size_t j;
+
+	    if (!table[i].key)
+		continue;
+	    j = key_hash(table[i].key, strlen(table[i].key)) & (nsize - 1);
+	    while (ntable[j].key)
+		j = (j + 1) & (nsize - 1);
+	    ntable[j] = table[i];
+	}
+	free(table);
+	table = ntable;
+	tsize = nsize;
+    }
+
+    for (i = key_hash(key, len) & (tsize - 1); (lp = table + i)->key;
+	 i = (i + 1) & (tsize - 1))
+	if (strncmp(lp->key, key, len) == 0 && lp->key[len] == '\0')
+	    return lp;
+
+    lp->key = malloc(len + 1);
+    if (!lp->key)
+	return NULL;
+    memcpy(lp->key, key, len);
+    lp->key[len] = '\0';
+    lp->value = 0;
+    tcount++;
+    return lp;
+}
+
+////////////////
+// output
+
+static void
+send_packets(void) {
+    int i;
+
+    if (npackets == 0)
+	return;
+#ifdef HAVE_SENDMMSG
+    {
+	struct mmsghdr msgs[MAX_PACKETS];
+	struct iovec iovs[MAX_PACKETS];
+	int sent = 0;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < npackets; i++) {
+	    iovs[i].iov_base = packets[i];
+	    iovs[i].iov_len = lens[i];
+	    msgs[i].msg_hdr.msg_iov = iovs + i;
+	    msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	while (sent < npackets) {
+	    int n = sendmmsg(sock, msgs + sent, npackets - sent, 0);
+
+	    if (n <= 0) {
+		PROM_SIMPLE_COUNTER_INC_BY(promstatsd_send_errors_total,
+					   npackets - sent);
+		break;
+	    }
+	    sent += n;
+	}
+	PROM_SIMPLE_COUNTER_INC_BY(promstatsd_packets_total, sent);
+    }
+#else
+    for (i = 0; i < npackets; i++) {
+	if (send(sock, packets[i], lens[i], 0) < 0)
+	    PROM_SIMPLE_COUNTER_INC(promstatsd_send_errors_total);
+	else
+	    PROM_SIMPLE_COUNTER_INC(promstatsd_packets_total);
+    }
+#endif
+    npackets = 0;
+}
+
+// add a line to current packet (starting a new one if it doesn't fit)
+static void
+add_line(const char *line, size_t len) {
+    size_t *lenp;
+
+    if (len > PACKET_SIZE)
+	return;
+    if (npackets > 0 && lens[npackets - 1] + 1 + len <= PACKET_SIZE) {
+	lenp = lens + npackets - 1;
+	packets[npackets - 1][(*lenp)++] = '\n';
+    }
+    else {
+	if (npackets == MAX_PACKETS)
+	    send_packets();
+	lenp = lens + npackets++;
+	*lenp = 0;
+    }
+    memcpy(packets[lenp - lens] + *lenp, line, len);
+    *lenp += len;
+}
+
+// append LEN bytes of STR to line, replacing characters
+// significant to StatsD
+static size_t
+put_clean(char *line, size_t pos, const char *str, size_t len) {
+    while (len-- > 0 && pos < LINE_MAX_LEN - 1) {
+	char c = *str++;
+
+	if (c == ':' || c == '|' || c == '@' || c == ',' || c == '#' ||
+	    c == '\n' || c == ' ')
+	    c = '_';
+	line[pos++] = c;
+    }
+    return pos;
+}
+
+// format name (with labels, for plain StatsD) into LINE
+static size_t
+put_name(char *line, const struct prom_sample *psp) {
+    struct prom_sample_label l;
+    const char *pos = psp->labels;
+    size_t n;
+
+    n = put_clean(line, 0, psp->name, psp->namelen);
+    if (!(flags & PROM_STATSD_TAGS))
+	while (pos && prom_sample_label(psp, &pos, &l)) {
+	    if (n >= LINE_MAX_LEN - 1)	// full: truncate
+		break;
+	    line[n++] = '.';
+	    n = put_clean(line, n, l.value, l.valuelen);
+	}
+    return n;
+}
+
+static size_t
+put_tags(char *line, size_t n, const struct prom_sample *psp) {
+    struct prom_sample_label l;
+    const char *pos = psp->labels;
+    int first = 1;
+
+    if (!(flags & PROM_STATSD_TAGS))
+	return n;
+    while (pos && prom_sample_label(psp, &pos, &l) && n < LINE_MAX_LEN - 4) {
+	n += snprintf(line + n, LINE_MAX_LEN - n, first ? "|#" : ",");
+	n = put_clean(line, n, l.name, l.namelen);
+	if (n >= LINE_MAX_LEN - 1)
+	    break;
+	line[n++] = ':';
+	n = put_clean(line, n, l.value, l.valuelen);
+	first = 0;
+    }
+    return n;
+}
+
+static int
+flush_sample(const struct prom_sample *psp, void *arg) {
+    char line[LINE_MAX_LEN + 64];
+    double value = psp->value;
+    size_t n, namelen;
+
+    (void) arg;
+    namelen = n = put_name(line, psp);
+    if (psp->type == COUNTER || psp->type == HISTOGRAM) {
+	// key is sample name and labels, as output
+	size_t keylen = psp->namelen;
+	struct last *lp;
+	double delta;
+
+	if (psp->labels)
+	    keylen = psp->labels + psp->labelslen - psp->name;
+	lp = last_lookup(psp->name, keylen);
+	if (!lp)
+	    return 0;
+	delta = value - lp->value;
+	if (delta < 0)			// reset
+	    delta = value;
+	lp->value = value;
+	if (delta == 0)
+	    return 0;
+	n += snprintf(line + n, sizeof(line) - n, ":%.15g|c", delta);
+    }
+    else {
+	if (value < 0) {		// "-N" would be a decrement
+	    n += snprintf(line + n, sizeof(line) - n, ":0|g");
+	    n = put_tags(line, n, psp);
+	    add_line(line, n);
+	    n = namelen;
+	}
+	n += snprintf(line + n, sizeof(line) - n, ":%.15g|g", value);
+    }
+    n = put_tags(line, n, psp);
+    add_line(line, n);
+    return 0;
+}
+
+// send all samples (counters as deltas since the last flush)
+// returns negative on failure
+int
+prom_statsd_flush(void) {
+    DECLARE_LOCK(statsd_lock);
+    int ret;
+
+    if (sock < 0)
+	return -1;
+    LOCK(statsd_lock);
+    ret = prom_sample_walk(flush_sample, NULL);
+    send_packets();
+    UNLOCK(statsd_lock);
+    return ret;
+}
+
+static void *
+prom_statsd_thread(void *arg) {
+    (void) arg;
+
+    for (;;) {
+	sleep(interval);
+	prom_statsd_flush();
+    }
+    return NULL;
+}
+
+// thread doesn't survive fork
+static void
+prom_statsd_child(void) {
+    interval = 0;
+}
+
+// send to StatsD server HOST:PORT (UDP)
+// FLAGS: PROM_STATSD_TAGS to send labels as DogStatsD tags
+// if SECS > 0, start a thread to flush every SECS seconds
+// returns negative on failure
+int
+prom_statsd_init(const char *host, const char *port, int flg, int secs) {
+    static int atfork;
+    struct addrinfo hints, *res, *ai;
+    pthread_t t;
+
+    if (sock >= 0)
+	return -1;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+	return -1;
+    for (ai = res; ai; ai = ai->ai_next) {
+	sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (sock < 0)
+	    continue;
+	if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+	    break;
+	close(sock);
+	sock = -1;
+    }
+    freeaddrinfo(res);
+    if (sock < 0)
+	return -1;
+    flags = flg;
+
+    if (secs <= 0)
+	return 0;
+    if (!atfork++)
+	pthread_atfork(NULL, NULL, prom_statsd_child);
+    interval = secs;
+    if (pthread_create(&t, NULL, prom_statsd_thread, NULL) != 0) {
+	interval = 0;
+	return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
@@ -0,0 +1,178 @@
+// write values to a file for the node_exporter "textfile" collector
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// For batch jobs and short-lived processes that never live long
+// enough to be scraped: output is rendered into a (reused) buffer,
+// written to a temporary file with one write(), and renamed into
+// place, so node_exporter never sees a partial file.
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>			/* fmemopen, snprintf, rename */
+#include <stdlib.h>			/* malloc */
+#include <string.h>
+#include <unistd.h>
+
+#include "prom.h"
+#include "common.h"
+
+#define INITIAL_SIZE (64*1024)
+
+static char *buf;			// rendered output
+static size_t bufsize;
+static char *last;			// last output written
+static size_t lastlen;
+
+static const char *periodic_dir, *periodic_name;
+static int periodic_interval;
+
+// render all vars into buf; returns length, or negative
+static long
+textfile_render(void) {
+    for (;;) {
+	FILE *f;
+	long len;
+
+	if (!buf) {
+	    bufsize = INITIAL_SIZE;
+	    buf = malloc(bufsize);
+	    if (!buf)
+		return -1;
+	}
+	f = fmemopen(buf, bufsize, "w");
+	if (!f)
+	    return -1;
+	prom_format_vars(f);
+	len = ftell(f);
+	if (fclose(f) == 0 && len >= 0 && (size_t)len < bufsize - 1)
+	    return len;
+
+	// may have been truncated: grow and try again
+	free(buf);
+	bufsize *= 2;
+	buf = malloc(bufsize);
+	if (!buf)
+	    return -1;
+    }
+}
+
+// write LEN bytes of buf to DIR/NAME via a temporary file
+static int
+textfile_put(const char *dir, const char *name, size_t len) {
+    char path[1024], tmp[1024];
+    ssize_t ret;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    // leading dot: not matched by node_exporter's *.prom
+    snprintf(tmp, sizeof(tmp), "%s/.%s.%d", dir, name, (int)getpid());
+    fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0)
+	return -1;
+    ret = write(fd, buf, len);
+    if (close(fd) < 0 || ret != (ssize_t)len || rename(tmp, path) < 0) {
+	unlink(tmp);
+	return -1;
+    }
+    return 0;
+}
+
+// returns 1 if written, 0 if unchanged (and !force), negative on error
+static int
+textfile_write(const char *dir, const char *name, int force) {
+    DECLARE_LOCK(textfile_lock);
+    long len;
+    int ret;
+
+    LOCK(textfile_lock);
+    len = textfile_render();
+    if (len < 0)
+	ret = -1;
+    else if (!force && last && (size_t)len == lastlen &&
+	     memcmp(buf, last, len) == 0)
+	ret = 0;
+    else if ((ret = textfile_put(dir, name, len)) == 0) {
+	char *copy = realloc(last, len + 1);
+
+	if (copy) {
+	    memcpy(copy, buf, len);
+	    last = copy;
+	    lastlen = len;
+	}
+	ret = 1;
+    }
+    UNLOCK(textfile_lock);
+    return ret;
+}
+
+// write all vars to DIR/NAME (NAME should end in .prom)
+// returns negative on failure
+int
+prom_textfile_write(const char *dir, const char *name) {
+    return textfile_write(dir, name, 1) < 0 ? -1 : 0;
+}
+
+static void *
+prom_textfile_thread(void *arg) {
+    (void) arg;
+
+    for (;;) {
+	textfile_write(periodic_dir, periodic_name, 0);
+	sleep(periodic_interval);
+    }
+    return NULL;
+}
+
+// thread doesn't survive fork
+static void
+prom_textfile_child(void) {
+    periodic_interval = 0;
+}
+
+// start thread to write DIR/NAME every INTERVAL seconds,
+// skipping the write when output has not changed.
+// call prom_textfile_write at exit for final values.
+// returns negative on failure
+int
+prom_textfile_init(const char *dir, const char *name, int interval) {
+    static int atfork;
+    pthread_t t;
+
+    if (interval <= 0 || periodic_interval)
+	return -1;
+    if (!atfork++)
+	pthread_atfork(NULL, NULL, prom_textfile_child);
+    periodic_dir = dir;
+    periodic_name = name;
+    periodic_interval = interval;
+    if (pthread_create(&t, NULL, prom_textfile_thread, NULL) != 0) {
+	periodic_interval = 0;
+	return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
@@ -0,0 +1,417 @@
+// per-thread CPU and scheduling metrics for Linux, labeled by thread name
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Call prom_threads_init() to load.  Reads /proc/self/task/*/stat
+// (thread name, and CPU time if no schedstat) and
+// /proc/self/task/*/schedstat (CPU time and run queue wait, in ns;
+// needs CONFIG_SCHED_INFO; without it there is no run queue wait
+// family at all).  Per-thread data is kept between walks
+// (sorted by tid); a walk opens two files per thread, so runs at most
+// every prom_threads_cache_ms (longer than most scrape intervals),
+// and only rereads a thread's stat (for its name) when the thread is
+// new, or every COMM_REFRESH walks.  Threads with the same name are
+// summed; totals of exited threads are kept so counters don't drop.
+// A thread that is renamed (or a tid reused by a new thread) has
+// what it counted so far moved to the exited totals for the old name.
+
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prom.h"
+#include "common.h"
+
+#define COMM_SIZE 32			// kernel limit is 16
+#define COMM_REFRESH 10			// walks between rereading stat
+
+struct thread {
+    pid_t tid;
+    int gen;				// walk last seen in
+    int age;				// walks since stat read
+    char comm[COMM_SIZE];		// empty until stat read
+    double cpu, wait;			// seconds
+    double base_cpu, base_wait;		// already counted under old name
+};
+
+struct comm_total {
+    char comm[COMM_SIZE];
+    double cpu, wait;
+};
+
+static struct thread *threads;		// sorted by tid
+static int nthreads, maxthreads;
+
+static struct comm_total *exited;	// totals for exited threads
+static int nexited, maxexited;
+
+static struct comm_total *totals;	// output (sorted by comm)
+static int ntotals;
+
+static DIR *task_dir;
+static int gen;
+static int have_schedstat;
+static long long last_walk;
+static long tix;
+
+// /proc/self/task walk costs scale with number of threads
+int prom_threads_cache_ms = 30000;
+
+DECLARE_LOCK(threads_lock);
+
+static long long
+now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// read a small file relative to /proc/self/task; returns length
+static ssize_t
+read_task_file(pid_t tid, const char *name, char *buf, size_t size) {
+    char path[64];
+    ssize_t len;
+    int fd;
+
+    snprintf(path, sizeof(path), "%d/%s", (int)tid, name);
+    fd = openat(dirfd(task_dir), path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+	return -1;
+    len = read(fd, buf, size);
+    close(fd);
+    return len;
+}
+
+// search first N (sorted) entries
+static struct thread *
+find_thread(pid_t tid, int n) {
+    int lo = 0, hi = n - 1;
+
+    while (lo <= hi) {
+	int mid = (lo + hi) / 2;
+
+	if (threads[mid].tid == tid)
+	    return threads + mid;
+	if (threads[mid].tid < tid)
+	    lo = mid + 1;
+	else
+	    hi = mid - 1;
+    }
+    return NULL;
+}
+
+static int
+thread_cmp(const void *a, const void *b) {
+    const struct thread *ta = a, *tb = b;
+
+    return (ta->tid > tb->tid) - (ta->tid < tb->tid);
+}
+
+static int
+total_cmp(const void *a, const void *b) {
+    return strcmp(((const struct comm_total *)a)->comm,
+		  ((const struct comm_total *)b)->comm);
+}
+
+// add to total for COMM in array *TP (of *NP, room for *MAXP)
+static void
+add_total(struct comm_total **tp, int *np, int *maxp,
+	  const char *comm, double cpu, double wait) {
+    struct comm_total *ctp;
+    int i;
+
+    for (i = 0; i < *np; i++)		// XXX linear
+	if (strcmp((*tp)[i].comm, comm) == 0)
+	    break;
+    if (i == *np) {
+	if (*np == *maxp) {
+	    int max = *maxp ? *maxp * 2 : 32;
+	    struct comm_total *new = realloc(*tp, max * sizeof(**tp));
+
+	    if (!new)
+		return;
+	    *tp = new;
+	    *maxp = max;
+	}
+	ctp = *tp + (*np)++;
+	strcpy(ctp->comm, comm);
+	ctp->cpu = ctp->wait = 0;
+    }
+    ctp = *tp + i;
+    ctp->cpu += cpu;
+    ctp->wait += wait;
+}
+
+// move what TP has counted under its current name to exited totals
+static void
+retire(struct thread *tp) {
+    if (tp->comm[0])
+	add_total(&exited, &nexited, &maxexited, tp->comm,
+		  tp->cpu - tp->base_cpu, tp->wait - tp->base_wait);
+}
+
+// TP's counts dropped: tid is now a different thread
+static void
+reused(struct thread *tp) {
+    retire(tp);
+    tp->base_cpu = tp->base_wait = 0;
+    tp->comm[0] = '\0';
+    tp->age = COMM_REFRESH;		// get new name
+}
+
+// read stat: name, and (if needed) utime + stime
+static void
+read_stat(struct thread *tp) {
+    char buf[1024], comm[COMM_SIZE];
+    const char *cp, *end;
+    unsigned long long v, ticks = 0;
+    ssize_t len;
+    int i;
+
+    len = read_task_file(tp->tid, "stat", buf, sizeof(buf));
+    if (len <= 0)
+	return;
+    end = buf + len;
+    cp = prom_proc_scan_num(buf, end, &v);		// pid
+    if (cp)
+	cp = prom_proc_scan_comm(cp, end, comm, sizeof(comm));
+    tp->age = 0;
+    if (!cp)
+	return;
+
+    if (!have_schedstat) {
+	// state, then fields 4-13, then utime (14) and stime (15)
+	while (cp < end && *cp == ' ')
+	    cp++;
+	cp++;
+	for (i = 4; cp && i <= 15; i++) {
+	    cp = prom_proc_scan_num(cp, end, &v);
+	    if (i >= 14)
+		ticks += v;
+	}
+	if (cp) {
+	    double cpu = (double)ticks / tix;
+
+	    if (cpu < tp->cpu)
+		reused(tp);
+	    tp->cpu = cpu;
+	}
+    }
+
+    if (tp->comm[0] && strcmp(comm, tp->comm) != 0) { // renamed
+	retire(tp);
+	tp->base_cpu = tp->cpu;
+	tp->base_wait = tp->wait;
+    }
+    strcpy(tp->comm, comm);
+}
+
+// read schedstat: "run_ns wait_ns timeslices"
+static void
+read_schedstat(struct thread *tp) {
+    char buf[128];
+    const char *cp, *end;
+    unsigned long long run, wait;
+    ssize_t len;
+
+    len = read_task_file(tp->tid, "schedstat", buf, sizeof(buf));
+    if (len <= 0)			// exited?
+	return;
+    end = buf + len;
+    cp = prom_proc_scan_num(buf, end, &run);
+    if (cp)
+	cp = prom_proc_scan_num(cp, end, &wait);
+    if (cp) {
+	if (run / 1e9 < tp->cpu || wait / 1e9 < tp->wait)
+	    reused(tp);
+	tp->cpu = run / 1e9;
+	tp->wait = wait / 1e9;
+    }
+}
+
+static void
+walk(void) {
+    static int maxtotals;
+    struct dirent *dp;
+    int i, j, nold = nthreads, added = 0;
+
+    if (!task_dir) {
+	task_dir = opendir("/proc/self/task");
+	if (!task_dir)
+	    return;
+	tix = sysconf(_SC_CLK_TCK);
+	have_schedstat = access("/proc/self/schedstat", R_OK) == 0;
+    }
+    else
+	rewinddir(task_dir);
+    gen++;
+
+    while ((dp = readdir(task_dir))) {
+	struct thread *tp;
+	pid_t tid = atoi(dp->d_name);
+
+	if (tid <= 0)
+	    continue;
+	tp = find_thread(tid, nold);
+	if (!tp) {
+	    if (nthreads == maxthreads) {
+		int max = maxthreads ? maxthreads * 2 : 64;
+		struct thread *new = realloc(threads, max * sizeof(*threads));
+
+		if (!new)
+		    continue;
+		threads = new;
+		maxthreads = max;
+	    }
+	    tp = threads + nthreads++;
+	    memset(tp, 0, sizeof(*tp));
+	    tp->tid = tid;
+	    tp->age = COMM_REFRESH;	// read stat below
+	    added = 1;
+	}
+	tp->gen = gen;
+	if (have_schedstat)
+	    read_schedstat(tp);
+	if (tp->age++ >= COMM_REFRESH || !have_schedstat)
+	    read_stat(tp);
+    }
+
+    // fold exited threads into exited totals, drop them
+    for (i = j = 0; i < nthreads; i++) {
+	if (threads[i].gen != gen) {
+	    retire(threads + i);
+	    continue;
+	}
+	threads[j++] = threads[i];
+    }
+    nthreads = j;
+    if (added)				// new threads were appended
+	qsort(threads, nthreads, sizeof(*threads), thread_cmp);
+
+    // sum by comm
+    ntotals = 0;
+    for (i = 0; i < nexited; i++)
+	add_total(&totals, &ntotals, &maxtotals,
+		  exited[i].comm, exited[i].cpu, exited[i].wait);
+    for (i = 0; i < nthreads; i++)
+	if (threads[i].comm[0])
+	    add_total(&totals, &ntotals, &maxtotals, threads[i].comm,
+		      threads[i].cpu - threads[i].base_cpu,
+		      threads[i].wait - threads[i].base_wait);
+    qsort(totals, ntotals, sizeof(*totals), total_cmp);
+}
+
+// walk if stale; call with threads_lock held
+static void
+refresh(void) {
+    long long now = now_ms();
+
+    if (last_walk && now - last_walk < prom_threads_cache_ms)
+	return;
+    walk();
+    last_walk = now;
+}
+
+// format COMM as a label value: escape backslash, quote, newline
+static const char *
+escape_comm(const char *comm, char *buf, size_t size) {
+    size_t n = 0;
+
+    for (; *comm && n + 2 < size; comm++) {
+	if (*comm == '\\' || *comm == '"')
+	    buf[n++] = '\\';
+	else if (*comm == '\n') {
+	    buf[n++] = '\\';
+	    buf[n++] = 'n';
+	    continue;
+	}
+	buf[n++] = *comm;
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+PROM_FORMAT_COUNTER_FN(process_thread_cpu_seconds_total,
+		       "CPU time used by threads, by thread name") {
+    char comm[COMM_SIZE * 2];
+    int i, state;
+
+    LOCK(threads_lock);
+    refresh();
+    for (i = 0; i < ntotals; i++) {
+	prom_format_start(f, &state, pvp);
+	prom_format_label(f, &state, "comm", "%s",
+			  escape_comm(totals[i].comm, comm, sizeof(comm)));
+	prom_format_value_dbl(f, &state, totals[i].cpu);
+    }
+    UNLOCK(threads_lock);
+    return 0;
+}
+
+PROM_FORMAT_COUNTER_FN(process_thread_run_queue_wait_seconds_total,
+		       "Time threads spent runnable waiting for a CPU, by thread name") {
+    char comm[COMM_SIZE * 2];
+    int i, state;
+
+    LOCK(threads_lock);
+    refresh();
+    // no schedstat: no samples, and no TYPE/HELP
+    for (i = 0; have_schedstat && i < ntotals; i++) {
+	prom_format_start(f, &state, pvp);
+	prom_format_label(f, &state, "comm", "%s",
+			  escape_comm(totals[i].comm, comm, sizeof(comm)));
+	prom_format_value_dbl(f, &state, totals[i].wait);
+    }
+    UNLOCK(threads_lock);
+    return 0;
+}
+
+// /proc/self was resolved at open: a child starts over
+static void
+prom_threads_child(void) {
+    if (task_dir)
+	closedir(task_dir);
+    task_dir = NULL;
+    nthreads = nexited = ntotals = 0;
+    last_walk = 0;
+}
+
+// call to load this file
+int
+prom_threads_init(void) {
+    static int atfork;
+
+    if (!atfork++)
+	pthread_atfork(NULL, NULL, prom_threads_child);
+    return 0;
+}
@@ -0,0 +1,148 @@
+// cheap clock for timing histograms
+
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// prom_ticks() reads the TSC when the CPU says it's invariant
+// (constant rate, doesn't stop in deep C-states), else returns
+// CLOCK_MONOTONIC nanoseconds.  The TSC rate is measured against
+// CLOCK_MONOTONIC, from the first prom_ticks() call until the first
+// time a rate is needed at least CALIBRATE_NS later.  Nothing waits:
+// before then, a provisional rate (measured since first use) is
+// returned, and prom_tick_calibrated stays zero.
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define HAVE_TSC
+#endif
+
+#include "prom.h"
+#include "common.h"
+
+#define CALIBRATE_NS 10000000		// 10ms
+
+int prom_tick_tsc;			// zero until first use
+int prom_tick_calibrated;		// seconds_per_tick is final
+static long long base_ns, base_tsc;	// at first use
+static double seconds_per_tick;		// valid once calibrated
+
+DECLARE_LOCK(ticks_lock);
+
+static long long
+mono_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef HAVE_TSC
+static long long
+tsc(void) {
+    return (long long)__builtin_ia32_rdtsc();
+}
+
+// CPUID.80000007H:EDX[8]
+static int
+tsc_invariant(void) {
+    unsigned a, b, c, d;
+
+    if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007)
+	return 0;
+    if (!__get_cpuid(0x80000007, &a, &b, &c, &d))
+	return 0;
+    return (d >> 8) & 1;
+}
+#endif
+
+// pick clock, and take base of TSC calibration (once)
+static void
+ticks_init(void) {
+    int tsc_ok = 0;
+
+    LOCK(ticks_lock);
+    if (!prom_tick_tsc) {
+#ifdef HAVE_TSC
+	tsc_ok = tsc_invariant();
+	if (tsc_ok) {
+	    base_ns = mono_ns();
+	    base_tsc = tsc();
+	}
+#endif
+	if (!tsc_ok) {
+	    seconds_per_tick = 1e-9;
+	    prom_tick_calibrated = 1;
+	}
+	__sync_synchronize();		// publish base before flag
+	prom_tick_tsc = tsc_ok ? 1 : -1;
+    }
+    UNLOCK(ticks_lock);
+}
+
+long long
+prom_ticks_slow(void) {
+    if (!prom_tick_tsc)
+	ticks_init();
+#ifdef HAVE_TSC
+    if (prom_tick_tsc > 0)
+	return tsc();
+#endif
+    return mono_ns();
+}
+
+// returns seconds per tick (provisional until prom_tick_calibrated)
+double
+prom_tick_seconds(void) {
+    double seconds;
+
+    if (prom_tick_calibrated) {
+	__sync_synchronize();		// read flag before rate
+	return seconds_per_tick;
+    }
+    if (!prom_tick_tsc)
+	ticks_init();
+
+    LOCK(ticks_lock);
+    seconds = seconds_per_tick;
+#ifdef HAVE_TSC
+    if (!prom_tick_calibrated) {
+	long long ns = mono_ns(), ticks = tsc();
+
+	seconds = 1e-9;			// no TSC ticks yet
+	if (ticks > base_tsc)
+	    seconds = (ns - base_ns) * 1e-9 / (ticks - base_tsc);
+	if (ns - base_ns >= CALIBRATE_NS) {
+	    seconds_per_tick = seconds;
+	    __sync_synchronize();	// publish rate before flag
+	    prom_tick_calibrated = 1;
+	}
+    }
+#endif
+    UNLOCK(ticks_lock);
+    return seconds;
+}
@@ -0,0 +1,158 @@
+// print values from a file written by prom_mmap_init
+// in Prometheus exposition format
+
+/*-
+ * SPDX-License-Identifier: MIT
+ *
+ * Copyright © 2020, Philip L. Budne
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// usage: promcat FILE
+// (for use by a node_exporter textfile job, or an agent)
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prom_mmap.h"
+
+#ifndef PROM_DOUBLE_FORMAT
+#define PROM_DOUBLE_FORMAT "%.15g"
+#endif
+
+static const char *base, *strs, *ns;
+static const int64_t *ints;
+static const double *dbls, *lims;
+
+#define STR(OFF) (strs + (OFF))
+
+static void
+start(const struct prom_mmap_ent *ep, const char *suffix) {
+    printf("%s%s%s", ns, STR(ep->name), suffix);
+}
+
+// print labels, and an optional extra label (le)
+static void
+labels(const struct prom_mmap_ent *ep, const char *extra, const char *val) {
+    int state = 0;
+
+    if (ep->labels) {
+	printf("{%s", STR(ep->labels));
+	state = 1;
+    }
+    if (extra)
+	printf("%c%s=\"%s\"", state++ ? ',' : '{', extra, val);
+    if (state)
+	putchar('}');
+}
+
+static void
+print_ent(const struct prom_mmap_ent *ep) {
+    char le[32];
+    unsigned i;
+
+    if (ep->type != PROM_MMAP_HISTOGRAM) {
+	start(ep, "");
+	labels(ep, NULL, NULL);
+	printf(" %lld\n", (long long)ints[ep->islot]);
+	return;
+    }
+
+    // nint is nbins+1: last bin is +Inf (count)
+    for (i = 0; i + 1 < ep->nint; i++) {
+	start(ep, "_bucket");
+	snprintf(le, sizeof(le), "%.15g", lims[ep->lims + i]);
+	labels(ep, "le", le);
+	printf(" %lld\n", (long long)ints[ep->islot + i]);
+    }
+    start(ep, "_bucket");
+    labels(ep, "le", "+Inf");
+    printf(" %lld\n", (long long)ints[ep->islot + i]);
+    start(ep, "_count");
+    labels(ep, NULL, NULL);
+    printf(" %lld\n", (long long)ints[ep->islot + i]);
+    start(ep, "_sum");
+    labels(ep, NULL, NULL);
+    printf(" " PROM_DOUBLE_FORMAT "\n", ep->ndbl ? dbls[ep->dslot] : 0.0);
+}
+
+int
+main(int argc, char **argv) {
+    static const char *types[] = { "gauge", "counter", "histogram" };
+    const struct prom_mmap_hdr *hdr;
+    const struct prom_mmap_ent *ents;
+    struct stat st;
+    unsigned i;
+    int fd;
+
+    if (argc != 2) {
+	fprintf(stderr, "usage: %s FILE\n", argv[0]);
+	return 2;
+    }
+    fd = open(argv[1], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+	perror(argv[1]);
+	return 1;
+    }
+    if ((size_t)st.st_size < sizeof(*hdr)) {
+	fprintf(stderr, "%s: too short\n", argv[1]);
+	return 1;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+	perror("mmap");
+	return 1;
+    }
+    hdr = (const struct prom_mmap_hdr *)base;
+    if (memcmp(hdr->magic, PROM_MMAP_MAGIC, sizeof(hdr->magic)) != 0 ||
+	hdr->version != PROM_MMAP_VERSION ||
+	hdr->dbls_off + hdr->ndbl * sizeof(double) > (uint64_t)st.st_size) {
+	fprintf(stderr, "%s: bad file\n", argv[1]);
+	return 1;
+    }
+
+    ents = (const struct prom_mmap_ent *)(base + hdr->ents_off);
+    strs = base + hdr->strs_off;
+    lims = (const double *)(base + hdr->lims_off);
+    ints = (const int64_t *)(base + hdr->ints_off);
+    dbls = (const double *)(base + hdr->dbls_off);
+    ns = STR(hdr->ns);
+
+    for (i = 0; i < hdr->nents; i++) {
+	const struct prom_mmap_ent *ep = ents + i;
+
+	// TYPE/HELP once per family: entries for a family are adjacent
+	if (i == 0 || ep->name != ents[i-1].name) {
+	    printf("# TYPE %s%s %s\n", ns, STR(ep->name),
+		   ep->type < 3 ? types[ep->type] : "untyped");
+	    if (ep->help)
+		printf("# HELP %s%s %s.\n", ns, STR(ep->name), STR(ep->help));
+	}
+	print_ent(ep);
+    }
+    return 0;
+}
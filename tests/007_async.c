@@ -0,0 +1,19 @@
+#include <unistd.h>
+
+#include "prom.h"
+
+static int calls;
+
+PROM_ASYNC_GETTER_GAUGE_FN(slow_gauge, "Gauge with an expensive getter") {
+    return ++calls;
+}
+
+int
+main() {
+    prom_format_vars(stdout);		/* no collector: called inline */
+    prom_collector_init(1);
+    sleep(2);
+    prom_format_vars(stdout);		/* returns collected value */
+    prom_format_vars(stdout);		/* same value: not called */
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+#define SLOW_USEC 300000
+
+PROM_GETTER_GAUGE_FN(slow_one, "Slow gauge one") {
+    usleep(SLOW_USEC);
+    return 1;
+}
+
+PROM_GETTER_GAUGE_FN(slow_two, "Slow gauge two") {
+    usleep(SLOW_USEC);
+    return 2;
+}
+
+PROM_FORMAT_COUNTER_FN(slow_three, "Slow formatted counter") {
+    int state;
+
+    usleep(SLOW_USEC);
+    prom_format_start(f, &state, pvp);
+    prom_format_label(f, &state, "kind", "%s", "slow");
+    return prom_format_value(f, &state, "%d", 3);
+}
+
+PROM_SIMPLE_COUNTER(fast_one, "Fast counter");
+
+static int stall;
+
+PROM_GETTER_GAUGE_FN(stalled, "Gauge whose getter sometimes stalls") {
+    if (stall)
+	sleep(2);
+    return stall;
+}
+
+static const struct prom_filter filters[] = {
+    { "slow_", 1 }, { "fast_", 1 }, { "stalled", 0 }
+};
+
+// scrape into memory; returns elapsed seconds
+static double
+scrape(double timeout, char **bufp) {
+    struct timeval t0, t1;
+    size_t len;
+    FILE *f = open_memstream(bufp, &len);
+
+    gettimeofday(&t0, NULL);
+    prom_format_vars_timeout(f, filters, 3, timeout);
+    gettimeofday(&t1, NULL);
+    fclose(f);
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+}
+
+int
+main() {
+    char *serial, *parallel, *late;
+    double elapsed;
+
+    prom_mark_slow("slow_one");
+    prom_mark_slow("slow_two");
+    prom_mark_slow("slow_three");
+    prom_mark_slow("stalled");
+
+    scrape(0, &serial);
+    fputs(serial, stdout);
+    if (prom_eval_init(4) < 0) {
+	printf("prom_eval_init failed\n");
+	return 1;
+    }
+    scrape(0, &parallel);
+    printf("parallel output %s\n",
+	   strcmp(parallel, serial) == 0 ? "matches serial" : "DIFFERS");
+
+    // stalled getter served from cache (stalled 0), and counted
+    stall = 1;
+    elapsed = scrape(0.5, &late);
+    printf("deadline output %s\n",
+	   strcmp(late, serial) == 0 ? "matches serial" : "DIFFERS");
+    printf("deadline scrape %s\n", elapsed < 1.0 ? "on time" : "LATE");
+    free(serial);
+    free(parallel);
+    free(late);
+    return 0;
+}
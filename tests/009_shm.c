@@ -0,0 +1,42 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+PROM_SIMPLE_COUNTER(requests, "Requests handled by all workers");
+PROM_SIMPLE_GAUGE(busy, "Busy workers");
+PROM_HISTOGRAM(latency, "Request latency");
+
+#define WORKERS 3
+
+int
+main() {
+    int i, j;
+
+    prom_shm_init(WORKERS + 1);
+    PROM_SIMPLE_COUNTER_INC(requests);	/* parent */
+
+    for (i = 0; i < WORKERS; i++) {
+	if (fork() == 0) {
+	    PROM_SIMPLE_GAUGE_INC(busy);
+	    for (j = 0; j < 10; j++) {
+		PROM_SIMPLE_COUNTER_INC(requests);
+		PROM_HISTOGRAM_OBSERVE(latency, 0.02);
+	    }
+	    if (i == 0) {		/* a live child exports */
+		prom_format_vars(stdout);
+		fflush(stdout);
+		sleep(1);
+	    }
+	    _exit(0);
+	}
+	if (i == 0)
+	    usleep(500000);		/* let first child report */
+    }
+    while (wait(NULL) > 0)
+	;
+
+    /* 31 requests, 30 observations; dead workers' gauges dropped */
+    prom_format_vars(stdout);
+    return 0;
+}
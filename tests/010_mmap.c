@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "prom.h"
+
+PROM_SIMPLE_COUNTER(requests, "Requests handled");
+PROM_HISTOGRAM(latency, "Request latency");
+
+PROM_LABELED_COUNTER(errors, "kind", "Errors by kind");
+PROM_SIMPLE_COUNTER_LABEL(errors, timeout);
+PROM_SIMPLE_COUNTER_LABEL(errors, refused);
+
+#define PATH "test_mmap.prom"
+
+int
+main() {
+    PROM_SIMPLE_COUNTER_INC(requests);	/* moved into file */
+    if (prom_mmap_init(PATH) < 0) {
+	perror(PATH);
+	return 1;
+    }
+    PROM_SIMPLE_COUNTER_INC(requests);
+    PROM_HISTOGRAM_OBSERVE(latency, 0.02);
+    PROM_SIMPLE_COUNTER_LABEL_INC_BY(errors, refused, 3);
+
+    fflush(stdout);
+    /* another process reads current values */
+    if (system("./promcat " PATH) != 0)
+	return 1;
+    remove(PATH);
+    return 0;
+}
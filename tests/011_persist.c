@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+PROM_SIMPLE_COUNTER(requests, "Requests handled");
+PROM_SIMPLE_GAUGE(busy, "Busy workers");
+PROM_HISTOGRAM(latency, "Request latency");
+
+#define PATH "test_persist.prom"
+#define RUNS 3
+
+int
+main() {
+    int run;
+
+    remove(PATH);
+    for (run = 0; run < RUNS; run++) {
+	if (fork() == 0) {		/* one "run" of the program */
+	    if (prom_mmap_persist(PATH) < 0) {
+		perror(PATH);
+		_exit(1);
+	    }
+	    PROM_SIMPLE_COUNTER_INC(requests);
+	    PROM_SIMPLE_GAUGE_INC(busy);
+	    PROM_HISTOGRAM_OBSERVE(latency, 0.02);
+	    if (run == RUNS - 1)	/* 3 requests, busy 1 */
+		prom_format_vars(stdout);
+	    fflush(stdout);
+	    _exit(0);
+	}
+	wait(NULL);
+    }
+    remove(PATH);
+    return 0;
+}
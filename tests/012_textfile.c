@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+PROM_SIMPLE_COUNTER(jobs, "Jobs completed");
+
+#define OUTDIR "."
+#define NAME "test_textfile.prom"
+
+static time_t
+mtime(void) {
+    struct stat st;
+    if (stat(OUTDIR "/" NAME, &st) < 0)
+	return 0;
+    return st.st_mtime;
+}
+
+int
+main() {
+    time_t first;
+
+    remove(OUTDIR "/" NAME);
+    prom_textfile_init(OUTDIR, NAME, 1);
+    sleep(1);
+    first = mtime();
+    printf("written: %s\n", first ? "yes" : "no");
+    sleep(2);				/* unchanged: not rewritten */
+    printf("unchanged rewritten: %s\n", mtime() != first ? "yes" : "no");
+
+    PROM_SIMPLE_COUNTER_INC(jobs);
+    prom_textfile_write(OUTDIR, NAME);	/* final values */
+    fflush(stdout);
+    system("cat " OUTDIR "/" NAME);
+    remove(OUTDIR "/" NAME);
+    return 0;
+}
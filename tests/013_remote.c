@@ -0,0 +1,198 @@
+// push to a stand-in remote write receiver
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+PROM_SIMPLE_COUNTER(test_requests, "Requests handled");
+PROM_LABELED_COUNTER(test_errors, "kind", "Errors by kind");
+PROM_SIMPLE_COUNTER_LABEL(test_errors, timeout);
+
+static int lfd, connections, posts;
+static unsigned char payload[65536];	/* first accepted, decompressed */
+static size_t payload_len;
+
+static uint64_t
+varint(const unsigned char **pp) {
+    uint64_t v = 0;
+    int shift = 0;
+
+    while (**pp & 0x80) {
+	v |= (uint64_t)(*(*pp)++ & 0x7f) << shift;
+	shift += 7;
+    }
+    return v | (uint64_t)*(*pp)++ << shift;
+}
+
+static size_t
+unsnappy(const unsigned char *in, size_t n, unsigned char *out) {
+    const unsigned char *end = in + n;
+    size_t len = varint(&in), op = 0, l, off;
+
+    while (in < end) {
+	int tag = *in++;
+	switch (tag & 3) {
+	case 0:
+	    l = tag >> 2;
+	    if (l >= 60) {
+		int i, nb = l - 59;
+		for (l = i = 0; i < nb; i++)
+		    l |= (size_t)*in++ << (8 * i);
+	    }
+	    memcpy(out + op, in, l + 1);
+	    in += l + 1;
+	    op += l + 1;
+	    continue;
+	case 1:
+	    l = ((tag >> 2) & 7) + 4;
+	    off = ((tag >> 5) << 8) | *in++;
+	    break;
+	case 2:
+	    l = (tag >> 2) + 1;
+	    off = in[0] | (in[1] << 8);
+	    in += 2;
+	    break;
+	default:
+	    l = (tag >> 2) + 1;
+	    off = in[0] | (in[1] << 8) | (in[2] << 16) | ((size_t)in[3] << 24);
+	    in += 4;
+	    break;
+	}
+	for (; l > 0; l--, op++)
+	    out[op] = out[op - off];
+    }
+    return op == len ? len : 0;
+}
+
+/* print series named test_* */
+static void
+print_payload(void) {
+    const unsigned char *p = payload, *end = payload + payload_len;
+
+    while (p < end) {
+	const unsigned char *ts, *tsend;
+	char line[512];
+	double value = 0;
+	int keep = 0;
+	size_t n;
+
+	p++;				/* timeseries */
+	ts = p;
+	n = varint(&ts);
+	tsend = ts + n;
+	line[0] = '\0';
+	while (ts < tsend) {
+	    int field = *ts++ >> 3;
+	    const unsigned char *m = ts, *mend;
+	    n = varint(&m);
+	    mend = m + n;
+	    if (field == 1) {		/* label */
+		size_t nl, vl;
+		const char *name, *val;
+		m++;
+		nl = varint(&m); name = (const char *)m; m += nl;
+		m++;
+		vl = varint(&m); val = (const char *)m;
+		if (nl == 8 && memcmp(name, "__name__", 8) == 0)
+		    keep = vl > 5 && memcmp(val, "test_", 5) == 0;
+		snprintf(line + strlen(line), sizeof(line) - strlen(line),
+			 " %.*s=%.*s", (int)nl, name, (int)vl, val);
+	    }
+	    else {			/* sample */
+		uint64_t bits = 0;
+		int i;
+		m++;
+		for (i = 0; i < 8; i++)
+		    bits |= (uint64_t)m[i] << (8 * i);
+		memcpy(&value, &bits, sizeof(value));
+	    }
+	    ts = mend;
+	}
+	if (keep)
+	    printf("%s %g\n", line, value);
+	p = tsend;
+    }
+}
+
+static void *
+receiver(void *arg) {
+    (void) arg;
+    for (;;) {
+	int fd = accept(lfd, NULL, NULL);
+	char hdr[4096];
+	static unsigned char body[65536];
+
+	if (fd < 0)
+	    break;
+	connections++;
+	for (;;) {			/* requests on this connection */
+	    size_t len = 0, clen;
+	    char *end, *cl;
+	    while (!(hdr[len] = '\0', end = strstr(hdr, "\r\n\r\n"))) {
+		ssize_t n = read(fd, hdr + len, sizeof(hdr) - 1 - len);
+		if (n <= 0)
+		    goto done;
+		len += n;
+	    }
+	    cl = strstr(hdr, "Content-Length: ");
+	    clen = cl ? strtoul(cl + 16, NULL, 10) : 0;
+	    len -= end + 4 - hdr;
+	    memcpy(body, end + 4, len);
+	    while (len < clen) {
+		ssize_t n = read(fd, body + len, clen - len);
+		if (n <= 0)
+		    goto done;
+		len += n;
+	    }
+	    if (posts++ == 0) {		/* first: ask for a retry */
+		const char *r = "HTTP/1.1 503 Busy\r\nContent-Length: 4\r\n\r\nbusy";
+		write(fd, r, strlen(r));
+		continue;
+	    }
+	    if (payload_len == 0)
+		payload_len = unsnappy(body, clen, payload);
+	    write(fd, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n", 38);
+	}
+    done:
+	close(fd);
+    }
+    return NULL;
+}
+
+int
+main() {
+    struct sockaddr_in sin;
+    socklen_t slen = sizeof(sin);
+    pthread_t t;
+    char url[64];
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(lfd, (struct sockaddr *)&sin, sizeof(sin));
+    listen(lfd, 5);
+    getsockname(lfd, (struct sockaddr *)&sin, &slen);
+    pthread_create(&t, NULL, receiver, NULL);
+
+    PROM_SIMPLE_COUNTER_INC_BY(test_requests, 42);
+    PROM_SIMPLE_COUNTER_LABEL_INC(test_errors, timeout);
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/api/v1/write",
+	     ntohs(sin.sin_port));
+    prom_remote_write_label("job", "test");
+    prom_remote_write_init(url, 1);
+    sleep(2);
+
+    print_payload();
+    printf("retried: %s\n", posts >= 3 ? "yes" : "no");
+    printf("connections: %d\n", connections);
+    return 0;
+}
@@ -0,0 +1,65 @@
+// flush to a local UDP socket standing in for a StatsD server
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+PROM_SIMPLE_COUNTER(test_requests, "Requests handled");
+PROM_SIMPLE_GAUGE(test_temperature, "Temperature");
+PROM_LABELED_COUNTER(test_errors, "kind", "Errors by kind");
+PROM_SIMPLE_COUNTER_LABEL(test_errors, timeout);
+
+static int fd;
+
+/* print received lines for test_* metrics */
+static void
+receive(void) {
+    char buf[2048];
+    ssize_t n;
+
+    while ((n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0) {
+	char *line, *save;
+
+	buf[n] = '\0';
+	for (line = strtok_r(buf, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save))
+	    if (strncmp(line, "test_", 5) == 0)
+		printf("%s\n", line);
+    }
+    printf("--\n");
+}
+
+int
+main() {
+    struct sockaddr_in sin;
+    socklen_t slen = sizeof(sin);
+    char port[16];
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr *)&sin, sizeof(sin));
+    getsockname(fd, (struct sockaddr *)&sin, &slen);
+    snprintf(port, sizeof(port), "%d", ntohs(sin.sin_port));
+
+    prom_statsd_init("127.0.0.1", port, PROM_STATSD_TAGS, 0);
+
+    PROM_SIMPLE_COUNTER_INC_BY(test_requests, 10);
+    PROM_SIMPLE_GAUGE_SET(test_temperature, -5);
+    PROM_SIMPLE_COUNTER_LABEL_INC(test_errors, timeout);
+    prom_statsd_flush();
+    usleep(100000);
+    receive();
+
+    PROM_SIMPLE_COUNTER_INC_BY(test_requests, 3); /* delta: 3 */
+    PROM_SIMPLE_GAUGE_SET(test_temperature, 20);
+    prom_statsd_flush();		/* test_errors unchanged: not sent */
+    usleep(100000);
+    receive();
+    return 0;
+}
@@ -0,0 +1,50 @@
+// Linux /proc collector
+#include <sys/prctl.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+/* print value of NAME from scrape output */
+static void
+show(const char *out, const char *name, int nonzero) {
+    const char *cp;
+    double v = -1;
+
+    for (cp = out; (cp = strstr(cp, name)); cp++)
+	if (cp[strlen(name)] == ' ' && (cp == out || cp[-1] == '\n')) {
+	    sscanf(cp + strlen(name), "%lf", &v);
+	    break;
+	}
+    if (nonzero)
+	printf("%s: %s\n", name, v > 0 ? "ok" : "MISSING");
+    else
+	printf("%s: %g\n", name, v);
+}
+
+int
+main() {
+    char out[16384];
+    FILE *f;
+
+    /* comm is (a) (b: spaces and parens */
+    prctl(PR_SET_NAME, "a) (b");
+    prom_process_init();
+    prom_smaps_cache_ms = 10000;	/* enable smaps_rollup */
+    usleep(10000);			/* a voluntary context switch */
+
+    f = fmemopen(out, sizeof(out), "w");
+    prom_format_vars(f);
+    fclose(f);
+
+    show(out, "num_threads", 0);
+    show(out, "process_virtual_memory_bytes", 1);
+    show(out, "process_resident_memory_bytes", 1);
+    show(out, "process_resident_memory_peak_bytes", 1);
+    show(out, "process_voluntary_context_switches_total", 1);
+    show(out, "process_memory_bytes{type=\"rss\"}", 1);
+    show(out, "process_memory_bytes{type=\"pss\"}", 1);
+    return 0;
+}
@@ -0,0 +1,95 @@
+// benchmark process_open_fds against readdir, with many open fds
+#include <sys/resource.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+#define ITERATIONS 20
+
+static double
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* what process_open_fds used to do
+ * (counts libprom's /proc/self/fd descriptor, which it doesn't) */
+static int
+readdir_count(void) {
+    DIR *d = opendir("/proc/self/fd");
+    struct dirent *dp;
+    int fds = 0;
+
+    while ((dp = readdir(d)))
+	if (dp->d_name[0] != '.')
+	    fds++;
+    closedir(d);
+    return fds - 1;
+}
+
+static double
+scrape_count(void) {
+    static const struct prom_filter filter = { "process_open_fds", 0 };
+    char out[1024];
+    double v = -1;
+    FILE *f = fmemopen(out, sizeof(out), "w");
+
+    prom_format_vars_filtered(f, &filter, 1);
+    fclose(f);
+    sscanf(out, "%*[^\n]\n%*[^\n]\nprocess_open_fds %lf", &v);
+    return v;
+}
+
+int
+main() {
+    static const int sizes[] = { 1000, 10000, 100000 };
+    struct rlimit rl;
+    unsigned i;
+    int j, fd, count;
+    double t, v = 0;
+
+    prom_process_init();
+    prom_process_cache_ms = 0;		/* time every call */
+    scrape_count();			/* opens /proc/self/fd */
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    fd = open("/dev/null", O_RDONLY);
+    printf("%8s %12s %12s\n", "fds", "readdir us", "libprom us");
+    for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+	if ((rlim_t)sizes[i] + 16 > rl.rlim_cur) {
+	    printf("%8d (RLIMIT_NOFILE %lu too low)\n",
+		   sizes[i], (unsigned long)rl.rlim_cur);
+	    continue;
+	}
+	for (count = readdir_count(); count < sizes[i]; count++)
+	    if (dup(fd) < 0) {
+		perror("dup");
+		return 1;
+	    }
+	if (readdir_count() < sizes[i]) {
+	    fprintf(stderr, "fd count below %d\n", sizes[i]);
+	    return 1;
+	}
+
+	t = now();
+	for (j = 0; j < ITERATIONS; j++)
+	    count = readdir_count();
+	printf("%8d %12.1f", count, (now() - t) / ITERATIONS * 1e6);
+
+	t = now();
+	for (j = 0; j < ITERATIONS; j++)
+	    v = scrape_count();
+	printf(" %12.1f%s\n", (now() - t) / ITERATIONS * 1e6,
+	       v == count - 1 ? "" : " (MISMATCH)");
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+// per-thread CPU by thread name
+#include <sys/prctl.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+static volatile int stop, rename_spinner;
+
+static void *
+spinner(void *arg) {
+    (void) arg;
+    prctl(PR_SET_NAME, "spinner");
+    while (!stop)
+	if (rename_spinner == 1) {
+	    prctl(PR_SET_NAME, "spin\"ner");	/* label must be escaped */
+	    rename_spinner = 2;
+	}
+    return NULL;
+}
+
+static void *
+sleeper(void *arg) {
+    (void) arg;
+    prctl(PR_SET_NAME, "sleeper");
+    while (!stop)
+	usleep(10000);
+    return NULL;
+}
+
+/* CPU seconds for thread COMM (as escaped in output) */
+static double
+cpu(const char *out, const char *comm) {
+    char pat[128];
+    const char *cp;
+    double v = -1;
+
+    snprintf(pat, sizeof(pat),
+	     "process_thread_cpu_seconds_total{comm=\"%s\"} ", comm);
+    if ((cp = strstr(out, pat)))
+	sscanf(cp + strlen(pat), "%lf", &v);
+    return v;
+}
+
+int
+main() {
+    pthread_t t1, t2;
+    char out[16384];
+    double before;
+    int i;
+    FILE *f;
+
+    prom_threads_init();
+    prom_threads_cache_ms = 1000;
+    pthread_create(&t1, NULL, spinner, NULL);
+    pthread_create(&t2, NULL, sleeper, NULL);
+    sleep(1);
+
+    f = fmemopen(out, sizeof(out), "w");
+    prom_format_vars(f);
+    fclose(f);
+    printf("spinner busy: %s\n", cpu(out, "spinner") > 0.5 ? "yes" : "no");
+    printf("sleeper busy: %s\n", cpu(out, "sleeper") > 0.5 ? "yes" : "no");
+    /* run queue wait family only with schedstat, TYPE/HELP included */
+    printf("wait family iff schedstat: %s\n",
+	   (access("/proc/self/schedstat", R_OK) == 0) ==
+	   (strstr(out, "process_thread_run_queue_wait_seconds_total") != NULL)
+	   ? "yes" : "no");
+
+    before = cpu(out, "spinner");	/* renamed thread's time is kept */
+    rename_spinner = 1;
+    while (rename_spinner != 2)
+	usleep(1000);
+    prom_threads_cache_ms = 0;		/* names reread every 10 walks */
+    for (i = 0; i < 11; i++) {
+	f = fmemopen(out, sizeof(out), "w");
+	prom_format_vars(f);
+	fclose(f);
+    }
+    printf("spinner not decreased: %s\n",
+	   cpu(out, "spinner") >= before ? "yes" : "no");
+    printf("renamed escaped: %s\n",
+	   cpu(out, "spin\\\"ner") >= 0 ? "yes" : "no");
+    prom_threads_cache_ms = 1000;
+
+    stop = 1;				/* exited threads' time is kept */
+    pthread_join(t1, NULL);
+    pthread_join(t2, NULL);
+    usleep(1100 * 1000);
+    f = fmemopen(out, sizeof(out), "w");
+    prom_format_vars(f);
+    fclose(f);
+    printf("spinner kept: %s\n", cpu(out, "spinner") > 0.5 ? "yes" : "no");
+    return 0;
+}
@@ -0,0 +1,33 @@
+// cgroup v2 metrics (output depends on where this runs)
+#include <stdio.h>
+#include <string.h>
+
+#include "prom.h"
+
+int
+main() {
+    static const struct prom_filter filter = { "cgroup_", 1 };
+    char line[512], type[512] = "";
+    int bare = 0;
+    FILE *f;
+
+    printf("cgroup v2: %s\n", prom_cgroup_init() == 0 ? "found" : "not found");
+    prom_format_vars_filtered(stdout, &filter, 1);
+
+    // missing files: no TYPE/HELP without samples
+    f = tmpfile();
+    prom_format_vars_filtered(f, &filter, 1);
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+	if (strncmp(line, "# TYPE ", 7) == 0) {
+	    bare += type[0] != '\0';
+	    strcpy(type, line);
+	}
+	else if (line[0] != '#')
+	    type[0] = '\0';
+    }
+    bare += type[0] != '\0';
+    fclose(f);
+    printf("families without samples: %d\n", bare);
+    return 0;
+}
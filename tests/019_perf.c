@@ -0,0 +1,104 @@
+// perf_event counters (software events only: hardware depends on host)
+#include <sys/wait.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+static void
+check(const char *output, const char *name) {
+    const char *cp = strstr(output, name);
+    double v;
+
+    if (!cp || sscanf(cp + strlen(name), " %lf", &v) != 1)
+	printf("%s: missing\n", name + 1);
+    else
+	printf("%s: %s\n", name + 1, v > 0 ? "ok" : "zero");
+}
+
+static const struct prom_filter filter = { "process_perf_", 1 };
+
+// scrape from a thread: must still count the main thread
+static void *
+scraper(void *arg) {
+    double *vp = arg;
+    char *output, *cp;
+    size_t size;
+    FILE *f;
+
+    f = open_memstream(&output, &size);
+    prom_format_vars_filtered(f, &filter, 1);
+    fclose(f);
+    cp = strstr(output, "\nprocess_perf_task_clock_seconds_total ");
+    if (cp)
+	sscanf(strchr(cp + 1, ' '), "%lf", vp);
+    free(output);
+    return NULL;
+}
+
+// in a forked child, burn CPU in the main thread, scrape from another
+static void
+child(void) {
+    volatile double x = 0;
+    struct timespec ts;
+    pthread_t t;
+    double v = 0;
+    int i;
+
+    for (i = 0; i < 50000000; i++)
+	x += i;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    pthread_create(&t, NULL, scraper, &v);
+    pthread_join(t, NULL);
+    printf("child counts whole process: %s\n",
+	   v >= (ts.tv_sec + ts.tv_nsec * 1e-9) / 2 ? "ok" : "no");
+    fflush(stdout);
+    _exit(0);
+}
+
+int
+main() {
+    volatile double x = 0;
+    char *buf, *output;
+    size_t size;
+    FILE *f;
+    int i;
+
+    prom_process_cache_ms = 0;
+    if (prom_perf_init() < 0) {
+	printf("perf: unavailable\n");	// ie; perf_event_paranoid 3
+	return 0;
+    }
+    printf("perf: ok\n");
+
+    for (i = 0; i < 10000000; i++)	// use some CPU
+	x += i;
+    buf = malloc(16 << 20);		// fault in some pages
+    memset(buf, 1, 16 << 20);
+    free(buf);
+
+    f = open_memstream(&output, &size);
+    prom_format_vars_filtered(f, &filter, 1);
+    fclose(f);
+
+    check(output, "\nprocess_perf_task_clock_seconds_total");
+    check(output, "\nprocess_perf_page_faults_total");
+    printf("context switches: %s\n",
+	   strstr(output, "\nprocess_perf_context_switches_total ") ?
+	   "present" : "missing");
+    printf("cpu migrations: %s\n",
+	   strstr(output, "\nprocess_perf_cpu_migrations_total ") ?
+	   "present" : "missing");
+    free(output);
+
+    fflush(stdout);
+    if (fork() == 0)
+	child();
+    wait(NULL);
+    return 0;
+}
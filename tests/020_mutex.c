@@ -0,0 +1,68 @@
+// instrumented mutexes: contention and hold time
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+PROM_MUTEX(quiet);
+PROM_MUTEX_HOLD(busy);
+
+static void *
+holder(void *arg) {
+    int i;
+
+    (void) arg;
+    for (i = 0; i < 20; i++) {
+	PROM_MUTEX_LOCK(busy);
+	usleep(1000);			// held 1ms
+	PROM_MUTEX_UNLOCK(busy);
+	usleep(100);
+    }
+    return NULL;
+}
+
+int
+main() {
+    static const struct prom_filter filter = { "prom_mutex_", 1 };
+    pthread_t t[2];
+    char line[256];
+    FILE *f;
+    int i;
+
+    for (i = 0; i < 1000; i++) {	// never contended
+	PROM_MUTEX_LOCK(quiet);
+	PROM_MUTEX_UNLOCK(quiet);
+    }
+
+    for (i = 0; i < 2; i++)
+	pthread_create(&t[i], NULL, holder, NULL);
+    for (i = 0; i < 2; i++)
+	pthread_join(t[i], NULL);
+
+    // only lines for this test's mutexes (library's own are unpredictable)
+    f = tmpfile();
+    prom_format_vars_filtered(f, &filter, 1);
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+	long long n;
+	char *cp;
+
+	if (strstr(line, "mutex=\"quiet\""))
+	    fputs(line, stdout);
+	else if ((cp = strstr(line, "mutex=\"busy\""))) {
+	    // counts depend on scheduling
+	    if (strstr(line, "contended_total") ||
+		strstr(line, "_count"))
+		printf("%.*s %s\n", (int)(strchr(cp, '}') + 1 - line), line,
+		       sscanf(strchr(cp, '}') + 1, "%lld", &n) == 1 && n > 0 ?
+		       "nonzero" : "ZERO");
+	    else if (strstr(line, "hold_seconds_bucket") &&
+		     strstr(line, "le=\"0.000256\""))
+		printf("busy held < 256us: %s", strchr(cp, '}') + 2);
+	}
+    }
+    fclose(f);
+    return 0;
+}
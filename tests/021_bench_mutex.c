@@ -0,0 +1,50 @@
+// benchmark uncontended PROM_MUTEX_LOCK/UNLOCK against pthread_mutex_lock
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "prom.h"
+
+#define ITERATIONS 10000000
+
+static pthread_mutex_t raw = PROM_MUTEX_INIT;
+PROM_MUTEX(bench);
+PROM_MUTEX_HOLD(bench_hold);
+
+static double
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main() {
+    double t0, raw_ns, prom_ns, hold_ns;
+    int i;
+
+    t0 = now();
+    for (i = 0; i < ITERATIONS; i++) {
+	pthread_mutex_lock(&raw);
+	pthread_mutex_unlock(&raw);
+    }
+    raw_ns = (now() - t0) * 1e9 / ITERATIONS;
+
+    t0 = now();
+    for (i = 0; i < ITERATIONS; i++) {
+	PROM_MUTEX_LOCK(bench);
+	PROM_MUTEX_UNLOCK(bench);
+    }
+    prom_ns = (now() - t0) * 1e9 / ITERATIONS;
+
+    t0 = now();
+    for (i = 0; i < ITERATIONS; i++) {
+	PROM_MUTEX_LOCK(bench_hold);
+	PROM_MUTEX_UNLOCK(bench_hold);
+    }
+    hold_ns = (now() - t0) * 1e9 / ITERATIONS;
+
+    printf("lock+unlock: pthread %.1fns, PROM_MUTEX %.1fns, "
+	   "PROM_MUTEX_HOLD %.1fns\n", raw_ns, prom_ns, hold_ns);
+    return 0;
+}
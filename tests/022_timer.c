@@ -0,0 +1,57 @@
+// PROM_HISTOGRAM_TIME_START/STOP
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+static double limits[] = { .001, .01, .1 };
+PROM_HISTOGRAM_CUSTOM(sleep_seconds, "Time spent in usleep(2000)", limits);
+
+int
+main() {
+    static const struct prom_filter filter = { "sleep_seconds", 0 };
+    char line[256], *cp;
+    double sum;
+    long n, prev = 0;
+    FILE *f;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+	PROM_HISTOGRAM_TIME_START(sleep_seconds);
+	usleep(2000);
+	PROM_HISTOGRAM_TIME_STOP(sleep_seconds);
+    }
+
+    f = tmpfile();
+    prom_format_vars_filtered(f, &filter, 1);
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+	if (strncmp(line, "sleep_seconds_sum ", 18) == 0) {
+	    // sleeps take at least 2ms, and (hopefully) much less than 50ms
+	    sscanf(line + 18, "%lf", &sum);
+	    printf("sleep_seconds_sum %s\n",
+		   sum >= .01 && sum < .05 ? "ok" : line + 18);
+	}
+	else if (strncmp(line, "sleep_seconds_bucket{", 21) == 0 &&
+		 (cp = strchr(line, '}'))) {
+	    // counts depend on scheduling: only check what can't vary;
+	    // no sleep is under 1ms, buckets are cumulative, all 5 in +Inf
+	    n = atol(cp + 2);
+	    cp[1] = '\0';
+	    printf("%s %s\n", line,
+		   n >= prev && n <= 5 &&
+		   (strstr(line, "\"0.001\"") ? n == 0 : 1) &&
+		   (strstr(line, "\"+Inf\"") ? n == 5 : 1) ? "ok" : "fail");
+	    prev = n;
+	}
+	else if (strncmp(line, "sleep_seconds_count ", 20) == 0)
+	    printf("sleep_seconds_count %s\n",
+		   atol(line + 20) == 5 ? "ok" : line + 20);
+	else
+	    fputs(line, stdout);
+    }
+    fclose(f);
+    return 0;
+}
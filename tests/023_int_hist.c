@@ -0,0 +1,25 @@
+// integer (power of two) histograms
+#include <stdio.h>
+
+#include "prom.h"
+
+PROM_INT_HISTOGRAM(batch_size, "Items per batch", 0, 4);
+PROM_INT_HISTOGRAM(message_bytes, "Message sizes", 6, 12);
+
+int
+main() {
+    static const long long sizes[] = { 0, 1, 2, 3, 4, 5, 16, 17, 1000 };
+    unsigned i;
+
+    for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+	PROM_INT_HISTOGRAM_OBSERVE(batch_size, sizes[i]);
+
+    PROM_INT_HISTOGRAM_OBSERVE(message_bytes, 64);
+    PROM_INT_HISTOGRAM_OBSERVE(message_bytes, 65);
+    PROM_INT_HISTOGRAM_OBSERVE(message_bytes, 4096);
+    PROM_INT_HISTOGRAM_OBSERVE(message_bytes, 4097);
+    PROM_INT_HISTOGRAM_OBSERVE(message_bytes, 1LL << 40);
+
+    prom_format_vars(stdout);
+    return 0;
+}
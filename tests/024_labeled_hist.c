@@ -0,0 +1,30 @@
+// histograms with one and two labels
+#include <stdio.h>
+
+#include "prom.h"
+
+static double limits[] = { .01, .1, 1 };
+
+PROM_LABELED_HISTOGRAM_CUSTOM(request_seconds, "endpoint",
+			      "Request time by endpoint", limits);
+PROM_HISTOGRAM_LABEL(request_seconds, login);
+PROM_HISTOGRAM_LABEL(request_seconds, search);
+PROM_HISTOGRAM_LABEL(request_seconds, idle);	// never observed
+
+PROM_2LABELED_HISTOGRAM(query_seconds, "db", "op", "Query time");
+PROM_HISTOGRAM_2LABEL(query_seconds, users, select);
+PROM_HISTOGRAM_2LABEL(query_seconds, users, update);
+
+int
+main() {
+    PROM_HISTOGRAM_LABEL_OBSERVE(request_seconds, login, .005);
+    PROM_HISTOGRAM_LABEL_OBSERVE(request_seconds, login, .05);
+    PROM_HISTOGRAM_LABEL_OBSERVE(request_seconds, search, .5);
+    PROM_HISTOGRAM_LABEL_OBSERVE(request_seconds, search, 5);
+
+    PROM_HISTOGRAM_2LABEL_OBSERVE(query_seconds, users, select, .002);
+    PROM_HISTOGRAM_2LABEL_OBSERVE(query_seconds, users, update, .2);
+
+    prom_format_vars(stdout);
+    return 0;
+}
@@ -0,0 +1,21 @@
+// counter arrays: label value chosen at runtime
+#include <stdio.h>
+
+#include "prom.h"
+
+static const char *const classes[] = { "1xx", "2xx", "3xx", "4xx", "5xx" };
+PROM_COUNTER_ARRAY(responses_total, "class", 5, classes,
+		   "HTTP responses by status class");
+
+int
+main() {
+    static const int statuses[] = { 200, 200, 204, 301, 404, 500, 503, 200 };
+    unsigned i;
+
+    for (i = 0; i < sizeof(statuses)/sizeof(statuses[0]); i++)
+	PROM_COUNTER_ARRAY_INC(responses_total, statuses[i] / 100 - 1);
+    PROM_COUNTER_ARRAY_INC_BY(responses_total, 0, 2);
+
+    prom_format_vars(stdout);
+    return 0;
+}
@@ -0,0 +1,50 @@
+// N labels: counters, gauges and histograms, and in a prom_mmap file
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "prom.h"
+
+PROM_NLABELED_COUNTER(http_requests, "Requests by method, path and code",
+		      "method", "path", "code");
+PROM_SIMPLE_COUNTER_NLABEL(http_requests, GET, root, 200);
+PROM_SIMPLE_COUNTER_NLABEL(http_requests, GET, root, 404);
+PROM_SIMPLE_COUNTER_NLABEL(http_requests, POST, login, 200);
+
+PROM_NLABELED_GAUGE(disks, "Disks by host, bus, model and state",
+		    "host", "bus", "model", "state");
+PROM_SIMPLE_GAUGE_NLABEL(disks, db1, sata, ssd, ok);
+PROM_GETTER_GAUGE_NLABEL_FN(disks, db1, nvme, ssd, failed) {
+    return 1;
+}
+
+static double limits[] = { .01, .1, 1 };
+PROM_NLABELED_HISTOGRAM_CUSTOM(rpc_seconds, "RPC time", limits,
+			       "service", "method", "zone");
+PROM_HISTOGRAM_NLABEL(rpc_seconds, users, get, east);
+PROM_HISTOGRAM_NLABEL(rpc_seconds, users, put, west);
+
+#define PATH "test_nlabel.prom"
+
+int
+main() {
+    if (prom_mmap_init(PATH) < 0) {
+	perror(PATH);
+	return 1;
+    }
+    PROM_SIMPLE_COUNTER_NLABEL_INC(http_requests, GET, root, 200);
+    PROM_SIMPLE_COUNTER_NLABEL_INC_BY(http_requests, 5, POST, login, 200);
+    PROM_SIMPLE_GAUGE_NLABEL_SET(disks, 3, db1, sata, ssd, ok);
+    PROM_SIMPLE_GAUGE_NLABEL_DEC(disks, db1, sata, ssd, ok);
+    PROM_HISTOGRAM_NLABEL_OBSERVE(rpc_seconds, .05, users, get, east);
+    PROM_HISTOGRAM_NLABEL_OBSERVE(rpc_seconds, 5, users, put, west);
+
+    prom_format_vars(stdout);
+
+    fflush(stdout);
+    printf("---- promcat\n");
+    fflush(stdout);
+    if (system("./promcat " PATH) != 0)
+	return 1;
+    remove(PATH);
+    return 0;
+}
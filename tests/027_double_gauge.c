@@ -0,0 +1,48 @@
+// double and fixed point gauges, updated from several threads
+#include <pthread.h>
+#include <stdio.h>
+
+#include "prom.h"
+
+PROM_DOUBLE_GAUGE(load_ratio, "Fraction of capacity in use");
+PROM_DOUBLE_GAUGE(queue_seconds_max, "Longest time spent queued");
+PROM_DOUBLE_GAUGE(queue_seconds_min, "Shortest time spent queued");
+PROM_DOUBLE_GAUGE(busy_seconds, "Time spent busy");
+PROM_FIXED_GAUGE(temperature_celsius, "Temperature", 1000);
+PROM_FIXED_GAUGE(balance, "Sum of deposits", 100);
+
+#define THREADS 4
+#define LOOPS 100000
+
+static void *
+worker(void *arg) {
+    long t = (long)arg;
+    int i;
+
+    for (i = 0; i < LOOPS; i++) {
+	PROM_DOUBLE_GAUGE_ADD(busy_seconds, 0.25);
+	PROM_DOUBLE_GAUGE_MAX(queue_seconds_max, t + i * 1e-6);
+	PROM_DOUBLE_GAUGE_MIN(queue_seconds_min, t + i * 1e-6);
+	PROM_FIXED_GAUGE_ADD(balance, 0.01);
+    }
+    return NULL;
+}
+
+int
+main() {
+    pthread_t threads[THREADS];
+    long t;
+
+    PROM_DOUBLE_GAUGE_SET(load_ratio, 0.625);
+    PROM_DOUBLE_GAUGE_SET(queue_seconds_min, 1e9);
+    PROM_FIXED_GAUGE_SET(temperature_celsius, 21.5);
+    PROM_FIXED_GAUGE_ADD(temperature_celsius, -0.125);
+
+    for (t = 0; t < THREADS; t++)
+	pthread_create(&threads[t], NULL, worker, (void *)t);
+    for (t = 0; t < THREADS; t++)
+	pthread_join(threads[t], NULL);
+
+    prom_format_vars(stdout);
+    return 0;
+}
@@ -0,0 +1,76 @@
+// prom_http_request query parameters and scrape timeout header
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prom.h"
+
+// families are formatted in name order: slow_a, then slow_b
+PROM_GETTER_GAUGE_FN(slow_a, "Takes 350ms") {
+    usleep(350 * 1000);
+    return 1;
+}
+
+PROM_GETTER_GAUGE_FN(slow_b, "Formatted after slow_a") {
+    return 2;
+}
+
+// run REQ through prom_http_request, print which families came back
+static void
+request(const char *what, const char *req) {
+    char in[1024], out[16384];
+    FILE *inf, *outf;
+
+    strcpy(in, req);
+    inf = fmemopen(in, strlen(in), "r");
+    outf = fmemopen(out, sizeof(out), "w");
+    prom_http_request(inf, outf, "test_http_query");
+    fclose(inf);
+    fclose(outf);
+    printf("%s:%s%s%s%s\n", what,
+	   strstr(out, "\nslow_a ") ? " slow_a" : "",
+	   strstr(out, "\nslow_b ") ? " slow_b" : "",
+	   strstr(out, " 400 ") ? " 400" : "",
+	   strstr(out, "\n# TYPE process_") ? " process_" : "");
+}
+
+#define HDR "X-Prometheus-Scrape-Timeout-Seconds: "
+
+int
+main() {
+    char req[1024];
+    int i;
+
+    prom_process_init();		/* other families to filter out */
+
+    request("name[]", "GET /metrics?name[]=slow_b HTTP/1.0\r\n\r\n");
+    request("name", "GET /metrics?name=slow_a HTTP/1.0\r\n\r\n");
+    request("name%5B%5D", "GET /metrics?name%5B%5D=slow_b HTTP/1.0\r\n\r\n");
+    request("two names",
+	    "GET /metrics?name[]=slow_a&name[]=slow_b HTTP/1.0\r\n\r\n");
+    request("prefix[]", "GET /metrics?prefix[]=slow_ HTTP/1.0\r\n\r\n");
+    request("prefix%5b%5d", "GET /metrics?prefix%5b%5d=slow HTTP/1.0\r\n\r\n");
+    request("unknown and empty ignored",
+	    "GET /metrics?foo=slow_a&name[]=&name[]=slow_b HTTP/1.0\r\n\r\n");
+    request("no proto", "GET /metrics?name[]=slow_b\r\n");
+
+    strcpy(req, "GET /metrics?name[]=slow_a");
+    for (i = 0; i < 32; i++)
+	strcat(req, "&name[]=slow_b");
+    strcat(req, " HTTP/1.0\r\n\r\n");
+    request("too many filters", req);
+
+    // slow_a ends after 0.9 * 0.38s: slow_b is skipped
+    request("timeout 0.38",
+	    "GET /metrics?prefix[]=slow_ HTTP/1.0\r\n" HDR "0.38\r\n\r\n");
+    request("timeout 0.5",
+	    "GET /metrics?prefix[]=slow_ HTTP/1.0\r\n" HDR "0.5\r\n\r\n");
+    request("timeout lower case",
+	    "GET /metrics?prefix[]=slow_ HTTP/1.0\r\n"
+	    "x-prometheus-scrape-timeout-seconds: 0.38\r\n\r\n");
+    request("timeout bad",
+	    "GET /metrics?prefix[]=slow_ HTTP/1.0\r\n" HDR "soon\r\n\r\n");
+    request("timeout negative",
+	    "GET /metrics?prefix[]=slow_ HTTP/1.0\r\n" HDR "-1\r\n\r\n");
+    return 0;
+}